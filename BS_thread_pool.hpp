@@ -15,6 +15,7 @@
     #undef BS_THREAD_POOL_ENABLE_WAIT_DEADLOCK_CHECK
 #endif
 
+#include <atomic>             // std::atomic
 #include <chrono>             // std::chrono
 #include <condition_variable> // std::condition_variable
 #include <cstddef>            // std::size_t
@@ -30,7 +31,7 @@
 #include <mutex>              // std::mutex, std::scoped_lock, std::unique_lock
 #include <optional>           // std::nullopt, std::optional
 #include <queue>              // std::priority_queue (if priority enabled), std::queue
-#ifdef BS_THREAD_POOL_ENABLE_WAIT_DEADLOCK_CHECK
+#ifndef BS_THREAD_POOL_DISABLE_EXCEPTION_HANDLING
     #include <stdexcept>      // std::runtime_error
 #endif
 #include <thread>             // std::thread
@@ -159,6 +160,83 @@ namespace this_thread {
     inline thread_local thread_info_pool get_pool;
 } // namespace this_thread
 
+/**
+ * @brief A handle for cooperative cancellation, shared by copying it: every copy refers to the same state. A task checks it at points where it can stop cleanly, such as between segments, and the pool checks it before starting a task submitted with it. A token is cancelled once `cancel()` has been called on any copy, or once its deadline, if it has one, has passed.
+ */
+class [[nodiscard]] cancel_token
+{
+public:
+    /**
+     * @brief Construct a new token that is not cancelled and has no deadline.
+     */
+    cancel_token() : state(std::make_shared<token_state>()) {}
+
+    /**
+     * @brief Construct a new token that is cancelled once the given duration has passed.
+     *
+     * @tparam R An arithmetic type representing the number of ticks.
+     * @tparam P An `std::ratio` representing the length of each tick in seconds.
+     * @param duration The time from now until the deadline.
+     */
+    template <typename R, typename P>
+    explicit cancel_token(const std::chrono::duration<R, P>& duration) : cancel_token()
+    {
+        cancel_at(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration));
+    }
+
+    /**
+     * @brief Request cancellation. Tasks that have already checked the token are not interrupted.
+     */
+    void cancel() const
+    {
+        state->requested.store(true, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Set the deadline after which the token counts as cancelled, replacing any earlier one.
+     *
+     * @param deadline The time point at which the token is cancelled.
+     */
+    void cancel_at(const std::chrono::steady_clock::time_point deadline) const
+    {
+        state->deadline.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Check whether cancellation has been requested or the deadline has passed. Cheap enough to call between units of work of a few microseconds.
+     *
+     * @return `true` if the work should stop.
+     */
+    [[nodiscard]] bool cancelled() const
+    {
+        if (state->requested.load(std::memory_order_relaxed))
+            return true;
+        const std::chrono::steady_clock::rep deadline = state->deadline.load(std::memory_order_relaxed);
+        return deadline != no_deadline && std::chrono::steady_clock::now().time_since_epoch().count() >= deadline;
+    }
+
+private:
+    static constexpr std::chrono::steady_clock::rep no_deadline = std::chrono::steady_clock::duration::max().count();
+
+    struct token_state
+    {
+        std::atomic<bool> requested = false;
+        std::atomic<std::chrono::steady_clock::rep> deadline = no_deadline;
+    };
+
+    std::shared_ptr<token_state> state;
+}; // class cancel_token
+
+#ifndef BS_THREAD_POOL_DISABLE_EXCEPTION_HANDLING
+/**
+ * @brief An exception stored in the future of a task that was submitted with a `cancel_token` and not started because the token had been cancelled by then. Only enabled if exception handling is enabled.
+ */
+struct task_cancelled : public std::runtime_error
+{
+    task_cancelled() : std::runtime_error("BS::task_cancelled"){};
+};
+#endif
+
 /**
  * @brief A helper class to facilitate waiting for and/or getting the results of multiple futures at once.
  *
@@ -202,6 +280,32 @@ public:
         }
     }
 
+#ifndef BS_THREAD_POOL_DISABLE_EXCEPTION_HANDLING
+    /**
+     * @brief Get the results of the tasks that ran, for futures of tasks submitted with a `cancel_token`: waits for all the futures and returns each one's value, or `std::nullopt` for a task that was cancelled before it started. Exceptions other than `task_cancelled` are rethrown. Only enabled if exception handling is enabled.
+     *
+     * @return A vector with one entry per future, in order.
+     */
+    template <typename U = T, typename = std::enable_if_t<!std::is_void_v<U>>>
+    [[nodiscard]] std::vector<std::optional<U>> get_partial()
+    {
+        std::vector<std::optional<U>> results;
+        results.reserve(this->size());
+        for (std::future<U>& future : *this)
+        {
+            try
+            {
+                results.emplace_back(future.get());
+            }
+            catch (const task_cancelled&)
+            {
+                results.emplace_back(std::nullopt);
+            }
+        }
+        return results;
+    }
+#endif
+
     /**
      * @brief Check how many of the futures stored in this `multi_future` are ready.
      *
@@ -282,6 +386,60 @@ public:
     }
 }; // class multi_future
 
+#ifdef BS_THREAD_POOL_ENABLE_PROFILING
+/**
+ * @brief Execution statistics accumulated by a single worker thread. Only enabled if `BS_THREAD_POOL_ENABLE_PROFILING` is defined.
+ */
+struct worker_stats
+{
+    /**
+     * @brief The number of tasks this worker has executed.
+     */
+    size_t tasks_executed = 0;
+
+    /**
+     * @brief The total time this worker has spent executing tasks.
+     */
+    std::chrono::steady_clock::duration busy_time = std::chrono::steady_clock::duration::zero();
+
+    /**
+     * @brief The total time this worker has spent waiting for a task to become available, measured from the end of its previous task (or its creation) to the start of the next one. A wait still in progress when the statistics are taken, such as the one after the worker's last task, is counted up to that moment.
+     */
+    std::chrono::steady_clock::duration idle_time = std::chrono::steady_clock::duration::zero();
+}; // struct worker_stats
+
+/**
+ * @brief A record describing a single executed task, passed to the task observer installed with `BS::thread_pool::set_task_observer()`. Only enabled if `BS_THREAD_POOL_ENABLE_PROFILING` is defined.
+ */
+struct task_record
+{
+    /**
+     * @brief The index of the worker thread that executed the task.
+     */
+    concurrency_t thread_index = 0;
+
+    /**
+     * @brief The time point at which the task started executing.
+     */
+    std::chrono::steady_clock::time_point start = {};
+
+    /**
+     * @brief The time point at which the task finished executing.
+     */
+    std::chrono::steady_clock::time_point end = {};
+
+    /**
+     * @brief The number of tasks left in the queue right after this task was retrieved from it.
+     */
+    size_t queue_depth = 0;
+}; // struct task_record
+
+/**
+ * @brief The type of the function called by the workers after each task when profiling is enabled.
+ */
+using task_observer_t = std::function<void(const task_record&)>;
+#endif
+
 /**
  * @brief A fast, lightweight, and easy-to-use C++17 thread pool class.
  */
@@ -416,6 +574,37 @@ public:
         return thread_ids;
     }
 
+#ifdef BS_THREAD_POOL_ENABLE_PROFILING
+    /**
+     * @brief Get a snapshot of the execution statistics of each of the pool's threads: the number of tasks executed, the time spent running them, and the time spent idle. The statistics are cleared whenever the pool is reset. Only enabled if `BS_THREAD_POOL_ENABLE_PROFILING` is defined.
+     *
+     * @return A vector containing the statistics of each thread, indexed by thread index.
+     */
+    [[nodiscard]] std::vector<worker_stats> get_worker_stats() const
+    {
+        const std::scoped_lock tasks_lock(tasks_mutex);
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::vector<worker_stats> snapshot(stats.get(), stats.get() + thread_count);
+        for (concurrency_t i = 0; i < thread_count; ++i)
+        {
+            if (idle_since[i] != std::chrono::steady_clock::time_point::min())
+                snapshot[i].idle_time += now - idle_since[i];
+        }
+        return snapshot;
+    }
+
+    /**
+     * @brief Install a function to be called by the worker threads after every task they execute. The function is called outside of the pool's lock, from the worker thread itself, so it must be thread-safe. Pass an empty function to remove the observer. Only enabled if `BS_THREAD_POOL_ENABLE_PROFILING` is defined.
+     *
+     * @param observer The function to call. It will receive a `task_record` describing the task that just finished.
+     */
+    void set_task_observer(const task_observer_t& observer)
+    {
+        const std::scoped_lock tasks_lock(tasks_mutex);
+        task_observer = observer ? std::make_shared<const task_observer_t>(observer) : nullptr;
+    }
+#endif
+
 #ifdef BS_THREAD_POOL_ENABLE_PAUSE
     /**
      * @brief Check whether the pool is currently paused. Only enabled if `BS_THREAD_POOL_ENABLE_PAUSE` is defined.
@@ -638,6 +827,30 @@ public:
         return task_promise->get_future();
     }
 
+#ifndef BS_THREAD_POOL_DISABLE_EXCEPTION_HANDLING
+    /**
+     * @brief Submit a function with no arguments into the task queue, like `submit_task()`, but skip it if the given token has been cancelled by the time a thread picks it up. The function itself can check the same token to stop early. Only enabled if exception handling is enabled.
+     *
+     * @tparam F The type of the function.
+     * @tparam R The return type of the function (can be `void`).
+     * @param task The function to submit.
+     * @param token The token to check before starting the task.
+     * @param priority The priority of the task. Should be between -32,768 and 32,767 (a signed 16-bit integer). The default is 0. Only enabled if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     * @return A future for the function's result, which holds a `task_cancelled` exception if the task was skipped.
+     */
+    template <typename F, typename R = std::invoke_result_t<std::decay_t<F>>>
+    [[nodiscard]] std::future<R> submit_task(F&& task, const cancel_token& token BS_THREAD_POOL_PRIORITY_INPUT)
+    {
+        return submit_task(
+            [task = std::forward<F>(task), token]
+            {
+                if (token.cancelled())
+                    throw task_cancelled();
+                return task();
+            } BS_THREAD_POOL_PRIORITY_OUTPUT);
+    }
+#endif
+
     /**
      * @brief Parallelize a loop by automatically splitting it into blocks and submitting each block separately to the queue, with the specified priority. The block function takes two arguments, the start and end of the block, so that it is only called only once per block, but it is up to the user make sure the block function correctly deals with all the indices in each block. Returns a `multi_future` that contains the futures for all of the blocks.
      *
@@ -732,6 +945,163 @@ public:
         return {};
     }
 
+#ifndef BS_THREAD_POOL_DISABLE_EXCEPTION_HANDLING
+    /**
+     * @brief Submit a sequence of tasks enumerated by indices, like `submit_sequence()`, but skip the tasks that have not started by the time the given token is cancelled. Use `multi_future::get_partial()` to collect the results of the tasks that ran. Only enabled if exception handling is enabled.
+     *
+     * @tparam T The type of the indices. Should be a signed or unsigned integer.
+     * @tparam F The type of the function used to define the sequence.
+     * @tparam R The return type of the function used to define the sequence (can be `void`).
+     * @param first_index The first index in the sequence.
+     * @param index_after_last The index after the last index in the sequence.
+     * @param sequence The function used to define the sequence. Will be called once per index that is not skipped. Should take exactly one argument, the index.
+     * @param token The token to check before starting each task.
+     * @param priority The priority of the tasks. Should be between -32,768 and 32,767 (a signed 16-bit integer). The default is 0. Only enabled if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     * @return A `multi_future` with one future per index; the futures of skipped tasks hold a `task_cancelled` exception.
+     */
+    template <typename T, typename F, typename R = std::invoke_result_t<std::decay_t<F>, T>>
+    [[nodiscard]] multi_future<R> submit_sequence(const T first_index, const T index_after_last, F&& sequence, const cancel_token& token BS_THREAD_POOL_PRIORITY_INPUT)
+    {
+        // Passed on as an lvalue, so that every task gets a copy of the shared pointer.
+        const auto guarded = [shared = std::make_shared<std::decay_t<F>>(std::forward<F>(sequence)), token](const T index)
+        {
+            if (token.cancelled())
+                throw task_cancelled();
+            return (*shared)(index);
+        };
+        return submit_sequence(first_index, index_after_last, guarded BS_THREAD_POOL_PRIORITY_OUTPUT);
+    }
+#endif
+
+    /**
+     * @brief Submit a sequence of tasks enumerated by indices, like `submit_sequence()`, and combine their results with a binary tree of merges that runs on the pool while the tasks are still finishing, with the specified priority. Each tree node is merged by whichever task completes the second of its two children, right away and on that task's thread, which then carries on up the tree; so no merge waits for unrelated tasks and there is no serial gather at the end. The left operand of every merge covers lower indices than the right one, so `merge` must be associative but need not be commutative. Returns a future for the combined result.
+     *
+     * @tparam T The type of the indices. Should be a signed or unsigned integer.
+     * @tparam F The type of the function used to define the sequence.
+     * @tparam M The type of the merge function.
+     * @tparam R The return type of the function used to define the sequence. Cannot be `void`, and must be default-constructible.
+     * @param first_index The first index in the sequence.
+     * @param index_after_last The index after the last index in the sequence. If `index_after_last <= first_index`, no tasks will be submitted, and the future will hold a value-initialized `R`.
+     * @param sequence The function used to define the sequence. Will be called once per index. Should take exactly one argument, the index.
+     * @param merge The function that combines two results. Should take two arguments of type `R`, the result for the lower indices first, and return their combination as an `R`.
+     * @param priority The priority of the tasks. Should be between -32,768 and 32,767 (a signed 16-bit integer). The default is 0. Only enabled if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     * @return A future for the result of merging all the results in index order. If a task or a merge throws an exception, the future holds the first such exception instead, and only becomes ready once every task has finished.
+     */
+    template <typename T, typename F, typename M, typename R = std::invoke_result_t<std::decay_t<F>, T>>
+    [[nodiscard]] std::future<R> submit_reduce(const T first_index, const T index_after_last, F&& sequence, M&& merge BS_THREAD_POOL_PRIORITY_INPUT)
+    {
+        static_assert(!std::is_void_v<R>, "submit_reduce() needs a sequence function that returns a value");
+        struct reduction
+        {
+            reduction(F&& sequence_, M&& merge_, const size_t count_) : sequence(std::forward<F>(sequence_)), merge(std::forward<M>(merge_)), count(count_)
+            {
+                while (leaves < count)
+                    leaves *= 2;
+                nodes = std::make_unique<std::optional<R>[]>(2 * leaves);
+                arrivals = std::make_unique<std::atomic<unsigned char>[]>(leaves);
+                for (size_t node = 0; node < leaves; ++node)
+                    arrivals[node].store(0, std::memory_order_relaxed);
+            }
+
+            // Node 1 is the root, node n has children 2n and 2n + 1, and the leaves are nodes leaves .. leaves + count - 1.
+            // A child exists if the first leaf below it does, so a node has 1 or 2 children.
+            unsigned char children(const size_t node) const
+            {
+                size_t first_leaf = 2 * node + 1;
+                while (first_leaf < leaves)
+                    first_leaf *= 2;
+                return first_leaf - leaves < count ? 2 : 1;
+            }
+
+            // Keeps the first exception. The future only gets it at the root, once every task has finished, since the tasks still use sequence and merge, and whatever those refer to, until then.
+            void fail()
+            {
+                if (!failed.exchange(true))
+                    error = std::current_exception();
+            }
+
+            // Stores the result for a leaf, then merges upwards for as long as this thread is the last to arrive at a node.
+            void complete(size_t node, std::optional<R>&& value)
+            {
+                nodes[node] = std::move(value);
+                while (node > 1)
+                {
+                    const size_t parent = node / 2;
+                    if (arrivals[parent].fetch_add(1, std::memory_order_acq_rel) + 1 < children(parent))
+                        return;
+                    std::optional<R>& left = nodes[2 * parent];
+                    std::optional<R>& right = nodes[2 * parent + 1];
+                    if (!failed.load(std::memory_order_relaxed) && left.has_value())
+                    {
+#ifndef BS_THREAD_POOL_DISABLE_EXCEPTION_HANDLING
+                        try
+                        {
+#endif
+                            if (right.has_value())
+                                nodes[parent].emplace(merge(std::move(*left), std::move(*right)));
+                            else
+                                nodes[parent] = std::move(left);
+#ifndef BS_THREAD_POOL_DISABLE_EXCEPTION_HANDLING
+                        }
+                        catch (...)
+                        {
+                            fail();
+                        }
+#endif
+                    }
+                    left.reset();
+                    right.reset();
+                    node = parent;
+                }
+                if (failed.load())
+                    result.set_exception(error);
+                else
+                    result.set_value(std::move(*nodes[1]));
+            }
+
+            std::decay_t<F> sequence;
+            std::decay_t<M> merge;
+            size_t count;
+            size_t leaves = 1;
+            std::unique_ptr<std::optional<R>[]> nodes;
+            std::unique_ptr<std::atomic<unsigned char>[]> arrivals;
+            std::atomic<bool> failed = false;
+            std::exception_ptr error;
+            std::promise<R> result;
+        };
+
+        if (index_after_last <= first_index)
+        {
+            std::promise<R> empty;
+            empty.set_value(R());
+            return empty.get_future();
+        }
+        const size_t count = static_cast<size_t>(index_after_last - first_index);
+        const std::shared_ptr<reduction> state = std::make_shared<reduction>(std::forward<F>(sequence), std::forward<M>(merge), count);
+        std::future<R> future = state->result.get_future();
+        for (size_t i = 0; i < count; ++i)
+            detach_task(
+                [state, index = static_cast<T>(first_index + static_cast<T>(i)), leaf = state->leaves + i]
+                {
+                    std::optional<R> value;
+#ifndef BS_THREAD_POOL_DISABLE_EXCEPTION_HANDLING
+                    try
+                    {
+#endif
+                        if (!state->failed.load(std::memory_order_relaxed))
+                            value.emplace(state->sequence(index));
+#ifndef BS_THREAD_POOL_DISABLE_EXCEPTION_HANDLING
+                    }
+                    catch (...)
+                    {
+                        state->fail();
+                    }
+#endif
+                    state->complete(leaf, std::move(value));
+                } BS_THREAD_POOL_PRIORITY_OUTPUT);
+        return future;
+    }
+
 #ifdef BS_THREAD_POOL_ENABLE_PAUSE
     /**
      * @brief Unpause the pool. The workers will resume retrieving new tasks out of the queue. Only enabled if `BS_THREAD_POOL_ENABLE_PAUSE` is defined.
@@ -860,6 +1230,12 @@ private:
             const std::scoped_lock tasks_lock(tasks_mutex);
             tasks_running = thread_count;
             workers_running = true;
+#ifdef BS_THREAD_POOL_ENABLE_PROFILING
+            stats = std::make_unique<worker_stats[]>(thread_count);
+            idle_since = std::make_unique<std::chrono::steady_clock::time_point[]>(thread_count);
+            for (concurrency_t i = 0; i < thread_count; ++i)
+                idle_since[i] = std::chrono::steady_clock::time_point::min();
+#endif
         }
         for (concurrency_t i = 0; i < thread_count; ++i)
         {
@@ -909,7 +1285,16 @@ private:
         this_thread::get_index.index = idx;
         this_thread::get_pool.pool = this;
         init_task();
+#ifdef BS_THREAD_POOL_ENABLE_PROFILING
+        std::chrono::steady_clock::time_point task_start;
+        std::chrono::steady_clock::time_point task_end;
+        size_t queue_depth = 0;
+        std::shared_ptr<const task_observer_t> observer = nullptr;
+#endif
         std::unique_lock tasks_lock(tasks_mutex);
+#ifdef BS_THREAD_POOL_ENABLE_PROFILING
+        idle_since[idx] = std::chrono::steady_clock::now();
+#endif
         while (true)
         {
             --tasks_running;
@@ -923,7 +1308,13 @@ private:
                     return !BS_THREAD_POOL_PAUSED_OR_EMPTY || !workers_running;
                 });
             if (!workers_running)
+            {
+#ifdef BS_THREAD_POOL_ENABLE_PROFILING
+                stats[idx].idle_time += std::chrono::steady_clock::now() - idle_since[idx];
+                idle_since[idx] = std::chrono::steady_clock::time_point::min();
+#endif
                 break;
+            }
             {
 #ifdef BS_THREAD_POOL_ENABLE_PRIORITY
                 const std::function<void()> task = std::move(std::remove_const_t<pr_task&>(tasks.top()).task);
@@ -931,12 +1322,29 @@ private:
 #else
                 const std::function<void()> task = std::move(tasks.front());
                 tasks.pop();
+#endif
+#ifdef BS_THREAD_POOL_ENABLE_PROFILING
+                queue_depth = tasks.size();
+                observer = task_observer;
+                task_start = std::chrono::steady_clock::now();
+                stats[idx].idle_time += task_start - idle_since[idx];
+                idle_since[idx] = std::chrono::steady_clock::time_point::min();
 #endif
                 ++tasks_running;
                 tasks_lock.unlock();
                 task();
+#ifdef BS_THREAD_POOL_ENABLE_PROFILING
+                task_end = std::chrono::steady_clock::now();
+                if (observer)
+                    (*observer)(task_record{idx, task_start, task_end, queue_depth});
+#endif
             }
             tasks_lock.lock();
+#ifdef BS_THREAD_POOL_ENABLE_PROFILING
+            ++stats[idx].tasks_executed;
+            stats[idx].busy_time += task_end - task_start;
+            idle_since[idx] = task_end;
+#endif
         }
         this_thread::get_index.index = std::nullopt;
         this_thread::get_pool.pool = std::nullopt;
@@ -1142,6 +1550,23 @@ private:
      */
     std::unique_ptr<std::thread[]> threads = nullptr;
 
+#ifdef BS_THREAD_POOL_ENABLE_PROFILING
+    /**
+     * @brief A smart pointer to manage the memory allocated for the per-thread execution statistics. Each entry is only modified by its own worker, while holding `tasks_mutex`.
+     */
+    std::unique_ptr<worker_stats[]> stats = nullptr;
+
+    /**
+     * @brief When each worker started its current wait for a task, or `time_point::min()` while it runs one or has exited. Lets `get_worker_stats()` count a wait that has not ended yet. Guarded by `tasks_mutex`.
+     */
+    std::unique_ptr<std::chrono::steady_clock::time_point[]> idle_since = nullptr;
+
+    /**
+     * @brief The function to call after each task, if any. Stored in a shared pointer so that workers can take a cheap copy while holding the lock.
+     */
+    std::shared_ptr<const task_observer_t> task_observer = nullptr;
+#endif
+
     /**
      * @brief A flag indicating that `wait()` is active and expects to be notified whenever a task is done.
      */
@@ -1152,5 +1577,158 @@ private:
      */
     bool workers_running = false;
 }; // class thread_pool
+
+/**
+ * @brief A graph of tasks with dependencies, run on a `thread_pool` without global barriers. Each task is added with the tasks it depends on (its predecessors), and is detached to the pool as soon as the last of them finishes, so independent chains of tasks overlap instead of each phase waiting for the slowest task of the previous one. A task whose completion makes several successors ready detaches all but one of them and runs that one itself right away, on the same thread, while its data is still in cache. Tasks take no arguments and return nothing; they pass data to their successors through storage they both capture.
+ */
+class [[nodiscard]] task_graph
+{
+public:
+    /**
+     * @brief The identifier of a task in the graph, returned by `add()` and `then()`.
+     */
+    using node = size_t;
+
+    /**
+     * @brief Construct an empty graph that will run on the given pool.
+     *
+     * @param pool_ The pool to run the tasks on. Must outlive the run.
+     */
+    explicit task_graph(thread_pool& pool_) : pool(pool_), state(std::make_shared<graph_state>()) {}
+
+    /**
+     * @brief Add a task that runs once all of the given tasks have finished. Must not be called after `run()`.
+     *
+     * @tparam F The type of the function.
+     * @param task The function to add. Should take no arguments and return nothing.
+     * @param predecessors The tasks it waits for, all previously added to this graph. If empty, the task is ready as soon as the graph runs.
+     * @return The identifier of the new task.
+     */
+    template <typename F>
+    node add(F&& task, const std::vector<node>& predecessors = {})
+    {
+        const node added = state->tasks.size();
+        state->tasks.emplace_back(std::forward<F>(task));
+        state->successors.emplace_back();
+        state->predecessor_counts.push_back(predecessors.size());
+        for (const node predecessor : predecessors)
+            state->successors[predecessor].push_back(added);
+        return added;
+    }
+
+    /**
+     * @brief Add a continuation: a task that runs as soon as the given task has finished. Equivalent to `add(task, {predecessor})`.
+     *
+     * @tparam F The type of the function.
+     * @param predecessor The task to continue.
+     * @param task The function to add. Should take no arguments and return nothing.
+     * @return The identifier of the new task.
+     */
+    template <typename F>
+    node then(const node predecessor, F&& task)
+    {
+        return add(std::forward<F>(task), {predecessor});
+    }
+
+    /**
+     * @brief Get the number of tasks in the graph.
+     *
+     * @return The number of tasks.
+     */
+    [[nodiscard]] size_t size() const
+    {
+        return state->tasks.size();
+    }
+
+    /**
+     * @brief Start running the graph: detach every task without predecessors to the pool. Should be called once, after the last task has been added. The graph object itself may be destroyed while it runs.
+     *
+     * @return A future that becomes ready once every task has finished. If a task throws an exception, the future holds the first such exception instead, and the tasks that have not started yet are skipped (but still counted as finished); the future is still only ready once every task has finished or been skipped.
+     */
+    [[nodiscard]] std::future<void> run()
+    {
+        std::future<void> future = state->done.get_future();
+        const size_t count = state->tasks.size();
+        if (count == 0)
+        {
+            state->done.set_value();
+            return future;
+        }
+        state->waiting = std::make_unique<std::atomic<size_t>[]>(count);
+        for (size_t i = 0; i < count; ++i)
+            state->waiting[i].store(state->predecessor_counts[i], std::memory_order_relaxed);
+        state->remaining.store(count, std::memory_order_relaxed);
+        for (node i = 0; i < count; ++i)
+            if (state->predecessor_counts[i] == 0)
+                launch(pool, state, i);
+        return future;
+    }
+
+private:
+    struct graph_state
+    {
+        std::vector<std::function<void()>> tasks;
+        std::vector<std::vector<node>> successors;
+        std::vector<size_t> predecessor_counts;
+        std::unique_ptr<std::atomic<size_t>[]> waiting;
+        std::atomic<size_t> remaining = 0;
+        std::atomic<bool> failed = false;
+        std::exception_ptr error;
+        std::promise<void> done;
+    };
+
+    // Runs a task and then, for as long as it makes a successor ready, that successor too; other successors that become ready are detached.
+    static void launch(thread_pool& pool, const std::shared_ptr<graph_state>& state, const node first)
+    {
+        pool.detach_task(
+            [&pool, state, first]
+            {
+                for (node current = first;;)
+                {
+                    if (!state->failed.load(std::memory_order_relaxed))
+                    {
+#ifndef BS_THREAD_POOL_DISABLE_EXCEPTION_HANDLING
+                        try
+                        {
+#endif
+                            state->tasks[current]();
+#ifndef BS_THREAD_POOL_DISABLE_EXCEPTION_HANDLING
+                        }
+                        catch (...)
+                        {
+                            if (!state->failed.exchange(true))
+                                state->error = std::current_exception();
+                        }
+#endif
+                    }
+                    state->tasks[current] = nullptr;
+                    std::optional<node> next;
+                    for (const node successor : state->successors[current])
+                    {
+                        if (state->waiting[successor].fetch_sub(1, std::memory_order_acq_rel) != 1)
+                            continue;
+                        if (next.has_value())
+                            launch(pool, state, successor);
+                        else
+                            next = successor;
+                    }
+                    // The future only becomes ready here, after the last task, so that a caller woken by an exception does not free what the other tasks still use.
+                    if (state->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    {
+                        if (state->failed.load())
+                            state->done.set_exception(state->error);
+                        else
+                            state->done.set_value();
+                    }
+                    if (!next.has_value())
+                        return;
+                    current = *next;
+                }
+            });
+    }
+
+    thread_pool& pool;
+    std::shared_ptr<graph_state> state;
+}; // class task_graph
 } // namespace BS
 #endif
@@ -0,0 +1,235 @@
+#ifndef AUTOTUNE_HPP
+#define AUTOTUNE_HPP
+
+/**
+ * Picks the segment size, thread count and wheel of the segmented sieve for the machine it runs on.
+ *
+ * The cache sizes are read from sysfs (Linux), then from cpuid leaf 4 (x86), then from sysconf, and turned into a
+ * short list of candidate segment sizes around L1 and L2. Each candidate is timed with a short calibration sieve,
+ * one parameter at a time (segment size, then wheel, then threads), and the winner is written to a profile file
+ * that later runs load on startup.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BS_thread_pool.hpp"
+#include "segmented_sieve.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#ifdef __unix__
+#include <unistd.h>
+#endif
+
+namespace autotune {
+
+const char* const PROFILE_FILE = "sieve_profile.txt";
+
+struct CacheSizes {
+    uint64_t l1d = 0;
+    uint64_t l2 = 0;
+    uint64_t l3 = 0;
+    std::string source = "default";
+};
+
+// Parses sysfs sizes such as "48K" or "2048K" or "1M".
+inline uint64_t parseCacheSize(const std::string &text){
+    uint64_t value = 0;
+    size_t i = 0;
+    while(i < text.size() && text[i] >= '0' && text[i] <= '9'){ value = value * 10 + (text[i++] - '0'); }
+    if(i < text.size() && (text[i] == 'K' || text[i] == 'k')){ value *= 1024; }
+    if(i < text.size() && (text[i] == 'M' || text[i] == 'm')){ value *= 1024 * 1024; }
+    return value;
+}
+
+inline bool probeSysfs(CacheSizes &caches){
+    for(int index = 0; index < 8; index++){
+        std::string directory = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+        std::ifstream levelFile(directory + "level"), typeFile(directory + "type"), sizeFile(directory + "size");
+        int level = 0;
+        std::string type, size;
+        if(!(levelFile >> level) || !(typeFile >> type) || !(sizeFile >> size)){ continue; }
+        if(type == "Instruction"){ continue; }
+        uint64_t bytes = parseCacheSize(size);
+        if(level == 1){ caches.l1d = bytes; }
+        if(level == 2){ caches.l2 = bytes; }
+        if(level == 3){ caches.l3 = bytes; }
+    }
+    if(caches.l1d == 0){ return false; }
+    caches.source = "sysfs";
+    return true;
+}
+
+inline bool probeCpuid(CacheSizes &caches){
+#if defined(__x86_64__) || defined(__i386__)
+    // Deterministic cache parameters (leaf 4): size = ways * partitions * line size * sets.
+    for(unsigned subleaf = 0; subleaf < 16; subleaf++){
+        unsigned eax, ebx, ecx, edx;
+        if(!__get_cpuid_count(4, subleaf, &eax, &ebx, &ecx, &edx)){ return false; }
+        unsigned type = eax & 0x1f;
+        if(type == 0){ break; }
+        if(type == 2){ continue; }  // instruction cache
+        unsigned level = (eax >> 5) & 0x7;
+        uint64_t bytes = (uint64_t)(((ebx >> 22) & 0x3ff) + 1) * (((ebx >> 12) & 0x3ff) + 1) * ((ebx & 0xfff) + 1) * (ecx + 1);
+        if(level == 1){ caches.l1d = bytes; }
+        if(level == 2){ caches.l2 = bytes; }
+        if(level == 3){ caches.l3 = bytes; }
+    }
+    if(caches.l1d == 0){ return false; }
+    caches.source = "cpuid";
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline bool probeSysconf(CacheSizes &caches){
+#if defined(__unix__) && defined(_SC_LEVEL1_DCACHE_SIZE)
+    long l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE), l2 = sysconf(_SC_LEVEL2_CACHE_SIZE), l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if(l1 <= 0){ return false; }
+    caches.l1d = l1;
+    caches.l2 = l2 > 0 ? l2 : 0;
+    caches.l3 = l3 > 0 ? l3 : 0;
+    caches.source = "sysconf";
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline CacheSizes probeCacheSizes(){
+    CacheSizes caches;
+    if(!probeSysfs(caches) && !probeCpuid(caches) && !probeSysconf(caches)){
+        caches.l1d = 32 * 1024;
+        caches.l2 = 256 * 1024;
+    }
+    if(caches.l2 == 0){ caches.l2 = caches.l1d * 8; }
+    return caches;
+}
+
+inline std::vector<uint64_t> segmentCandidates(const CacheSizes &caches){
+
+    // The bitmap should leave room in L1 for the base primes and wheel tables, so half of L1 is the usual winner,
+    // but on large ranges the per-segment overhead of restarting every base prime can favour L2-sized segments.
+
+    std::vector<uint64_t> candidates;
+    for(uint64_t bytes : {caches.l1d / 2, caches.l1d, caches.l2 / 4, caches.l2 / 2}){
+        bytes = std::max<uint64_t>(bytes & ~63ULL, 1024);
+        if(std::find(candidates.begin(), candidates.end(), bytes) == candidates.end()){ candidates.push_back(bytes); }
+    }
+    return candidates;
+}
+
+inline std::vector<unsigned> threadCandidates(){
+    unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> candidates;
+    for(unsigned threads = 1; threads < hardware; threads *= 2){ candidates.push_back(threads); }
+    candidates.push_back(hardware);
+    return candidates;
+}
+
+// Best of a few runs, in milliseconds, of a full count/sum sieve up to limit.
+inline double timeConfig(BS::thread_pool &pool, const segsieve::SieveConfig &config, uint64_t limit, int repetitions = 2){
+    if(pool.get_thread_count() != config.threads){ pool.reset(config.threads); }
+    double best = 1e300;
+    for(int i = 0; i < repetitions; i++){
+        auto start = std::chrono::steady_clock::now();
+        segsieve::PrimeSummary summary = segsieve::summarizeRange(pool, 0, limit, config);
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if(summary.count > 0){ best = std::min(best, elapsed); }
+    }
+    return best;
+}
+
+inline void logCandidate(std::ostream &log, const segsieve::SieveConfig &config, double milliseconds){
+    log << "  threads " << std::setw(3) << config.threads << "  segment " << std::setw(8) << config.segmentBytes
+        << " B  wheel " << std::setw(3) << config.wheel << "  ->  " << std::fixed << std::setprecision(1) << milliseconds << " ms" << std::endl;
+}
+
+// Tunes one parameter at a time, keeping the best value of each before moving on to the next.
+inline segsieve::SieveConfig tune(BS::thread_pool &pool, const CacheSizes &caches, uint64_t calibrationLimit, std::ostream &log){
+    segsieve::SieveConfig best;
+    best.threads = threadCandidates().back();
+    double bestTime = 1e300;
+
+    log << "caches (" << caches.source << "): L1d " << caches.l1d << " B, L2 " << caches.l2 << " B, L3 " << caches.l3 << " B" << std::endl;
+    log << "calibrating on primes up to " << calibrationLimit << std::endl;
+
+    auto consider = [&] (segsieve::SieveConfig candidate) {
+        double milliseconds = timeConfig(pool, candidate, calibrationLimit);
+        logCandidate(log, candidate, milliseconds);
+        if(milliseconds < bestTime){
+            bestTime = milliseconds;
+            best = candidate;
+        }
+    };
+
+    segsieve::SieveConfig candidate = best;
+    for(uint64_t bytes : segmentCandidates(caches)){
+        candidate.segmentBytes = bytes;
+        consider(candidate);
+    }
+    candidate = best;
+    for(unsigned wheel : {2u, 30u, 210u}){
+        if(wheel == best.wheel){ continue; }
+        candidate.wheel = wheel;
+        consider(candidate);
+    }
+    candidate = best;
+    for(unsigned threads : threadCandidates()){
+        if(threads == best.threads){ continue; }
+        candidate.threads = threads;
+        consider(candidate);
+    }
+    log << "chosen:" << std::endl;
+    logCandidate(log, best, bestTime);
+    return best;
+}
+
+inline bool saveProfile(const std::string &path, const segsieve::SieveConfig &config, const CacheSizes &caches){
+    std::ofstream file(path);
+    if(!file){ return false; }
+    file << "# written by ./main.exe --autotune; delete this file to go back to the defaults" << std::endl;
+    file << "# caches (" << caches.source << "): l1d=" << caches.l1d << " l2=" << caches.l2 << " l3=" << caches.l3 << std::endl;
+    file << "threads=" << config.threads << std::endl;
+    file << "segment_bytes=" << config.segmentBytes << std::endl;
+    file << "wheel=" << config.wheel << std::endl;
+    return (bool)file;
+}
+
+// Reads a profile written by saveProfile into config. Unknown keys are ignored; returns false, leaving config as it
+// was, if there is no file or a value does not parse.
+inline bool loadProfile(const std::string &path, segsieve::SieveConfig &config){
+    std::ifstream file(path);
+    if(!file){ return false; }
+    segsieve::SieveConfig loaded = config;
+    std::string line;
+    try {
+        while(std::getline(file, line)){
+            if(line.empty() || line[0] == '#'){ continue; }
+            size_t equals = line.find('=');
+            if(equals == std::string::npos){ continue; }
+            std::string key = line.substr(0, equals);
+            uint64_t value = std::stoull(line.substr(equals + 1));
+            if(key == "threads" && value > 0){ loaded.threads = (unsigned)value; }
+            if(key == "segment_bytes" && value > 0){ loaded.segmentBytes = value; }
+            if(key == "wheel" && (value == 2 || value == 30 || value == 210)){ loaded.wheel = (unsigned)value; }
+        }
+    } catch(const std::exception&){
+        return false;
+    }
+    config = loaded;
+    return true;
+}
+
+} // namespace autotune
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef FACTOR_SIEVE_HPP
+#define FACTOR_SIEVE_HPP
+
+/**
+ * The complete factorisation of every number in a range, segment by segment, without a table of the whole range.
+ *
+ * A segment holds every number of [low, high] (even ones too; every multiple needs its factor, so the wheel cannot
+ * skip any). It starts with cofactor[i] = low + i, and every prime p up to sqrt(high) walks its multiples in the
+ * segment, divides its full power out of the cofactor and links (p, exponent) onto that number's list. Whatever
+ * cofactor is left is 1 or one prime above sqrt(high). The divisions are exact, so they are done as multiplications
+ * by p^-1 mod 2^64 (primality::divisorFor), and by shifts for 2.
+ *
+ * The lists live in one flat array of 12-byte links, chained from each number's last (largest) base prime, next to
+ * a uint32 smallest-prime-factor table; with the 64-bit cofactors that is about 50 bytes per number for one segment
+ * per thread, whatever the size of the range. factorRange() hands each finished segment to a consumer on the worker
+ * that factorised it, the way segsieve::sieveRange() hands out bitmap segments, and returns the consumers' results
+ * in order. forEachSegment() passes the results on one at a time instead, with only a few segments per thread in
+ * flight, so that long ranges keep a bounded number of results (e.g. the lines of text of --factor) in memory.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <type_traits>
+#include <vector>
+#include "BS_thread_pool.hpp"
+#include "primality.hpp"
+#include "segmented_sieve.hpp"
+
+namespace factorsieve {
+
+const uint64_t SEGMENT_NUMBERS = 1 << 14;  // numbers per segment: its tables come to about 800 KB
+const size_t SEGMENTS_PER_THREAD = 4;      // segments forEachSegment() keeps in flight per thread
+const uint64_t MAX_HIGH = 1ULL << 50;      // base primes up to 2^25, so the list links stay 32-bit
+const size_t MAX_FACTORS = 15;             // distinct primes of a 64-bit number: 2 * 3 * ... * 53 > 2^64
+const uint32_t NO_LINK = UINT32_MAX;
+
+struct Factor {
+    uint64_t prime;
+    unsigned exponent;
+};
+
+struct FactorLink {
+    uint32_t prime;
+    uint32_t next;      // the link of the same number's next smaller base prime, or NO_LINK
+    uint32_t exponent;
+};
+
+// The factorisations of one finished segment. Valid until the worker that produced it factorises its next segment.
+struct FactorSegment {
+    uint64_t low = 0;
+    uint64_t high = 0;
+    const uint32_t* smallest = nullptr;  // smallest prime factor of low + i if it is at most sqrt(high), otherwise 0
+    const uint32_t* lastLink = nullptr;  // the link of the largest such prime, or NO_LINK
+    const uint64_t* cofactor = nullptr;  // 1 or the one prime factor above sqrt(high) (0 for n = 0)
+    const FactorLink* links = nullptr;
+
+    // n itself for primes and 1, and 0 for 0.
+    uint64_t smallestFactor(uint64_t n) const {
+        uint32_t p = smallest[n - low];
+        return p != 0 ? p : n;
+    }
+
+    bool isPrime(uint64_t n) const {
+        uint32_t p = smallest[n - low];
+        return n >= 2 && (p == 0 || p == n);
+    }
+
+    // Writes the prime factors of n in increasing order to out, which has room for MAX_FACTORS, and returns how many
+    // there are; 0 and 1 have none.
+    size_t factorsOf(uint64_t n, Factor* out) const {
+        size_t i = n - low, count = 0;
+        for(uint32_t link = lastLink[i]; link != NO_LINK; link = links[link].next){
+            out[count++] = {links[link].prime, links[link].exponent};
+        }
+        std::reverse(out, out + count);
+        if(cofactor[i] > 1){ out[count++] = {cofactor[i], 1}; }
+        return count;
+    }
+
+    // Calls visit(n, factors, count) for every n of the segment in increasing order.
+    template <typename F>
+    void forEach(F &&visit) const {
+        Factor factors[MAX_FACTORS];
+        for(uint64_t n = low;; n++){
+            visit(n, (const Factor*)factors, factorsOf(n, factors));
+            if(n == high){ break; }
+        }
+    }
+};
+
+// The odd primes up to sqrt(high) with their inverses. 2 is handled with shifts.
+inline std::vector<primality::SmallDivisor> baseDivisors(uint64_t high){
+    std::vector<primality::SmallDivisor> divisors;
+    for(uint32_t p : segsieve::simpleSieve(segsieve::integerSqrt(high))){
+        if(p != 2){ divisors.push_back(primality::divisorFor(p)); }
+    }
+    return divisors;
+}
+
+// Factorises [low, high] (at most SEGMENT_NUMBERS numbers, high <= MAX_HIGH) into the calling thread's tables.
+inline FactorSegment factorSegment(uint64_t low, uint64_t high, const std::vector<primality::SmallDivisor> &divisors){
+    struct Tables {
+        std::vector<uint32_t> smallest, lastLink;
+        std::vector<uint64_t> cofactor;
+        std::vector<FactorLink> links;
+    };
+    thread_local Tables tables;
+    size_t size = (size_t)(high - low + 1);
+    tables.smallest.assign(size, 0);
+    tables.lastLink.assign(size, NO_LINK);
+    tables.cofactor.resize(size);
+    tables.links.clear();
+    tables.links.reserve(4 * size);
+    for(size_t i = 0; i < size; i++){ tables.cofactor[i] = low + i; }
+
+    uint32_t* smallest = tables.smallest.data();
+    uint32_t* lastLink = tables.lastLink.data();
+    uint64_t* cofactor = tables.cofactor.data();
+    auto link = [&] (size_t i, uint32_t p, uint32_t exponent) {
+        if(smallest[i] == 0){ smallest[i] = p; }
+        tables.links.push_back({p, lastLink[i], exponent});
+        lastLink[i] = (uint32_t)(tables.links.size() - 1);
+    };
+
+    for(uint64_t n = std::max<uint64_t>(low + (low & 1), 2); n <= high; n += 2){
+        size_t i = n - low;
+        int twos = __builtin_ctzll(cofactor[i]);
+        cofactor[i] >>= twos;
+        link(i, 2, twos);
+    }
+    for(const primality::SmallDivisor &d : divisors){
+        uint64_t p = d.prime;
+        if(p * p > high){ break; }
+        for(uint64_t n = std::max(p, (low + p - 1) / p * p); n <= high; n += p){
+            size_t i = n - low;
+            uint64_t quotient = cofactor[i] * d.inverse;  // p divides it: the smaller primes are already divided out
+            uint32_t exponent = 1;
+            while(quotient * d.inverse <= d.limit){
+                quotient *= d.inverse;
+                exponent++;
+            }
+            cofactor[i] = quotient;
+            link(i, (uint32_t)p, exponent);
+        }
+    }
+    return {low, high, smallest, lastLink, cofactor, tables.links.data()};
+}
+
+// Factorises [low, high] on the pool, segment by segment, and returns consume(segment) for every segment in order.
+// consume runs on the workers, several at once, and must return a value.
+template <typename Consume>
+std::vector<std::invoke_result_t<Consume&, const FactorSegment&>> factorRange(BS::thread_pool &pool, uint64_t low, uint64_t high, Consume consume){
+    using Result = std::invoke_result_t<Consume&, const FactorSegment&>;
+    if(high < low){ return {}; }
+    size_t segments = (size_t)((high - low) / SEGMENT_NUMBERS + 1);
+    const std::vector<primality::SmallDivisor> divisors = baseDivisors(high);
+    BS::multi_future<Result> futures = pool.submit_sequence<size_t>(0, segments, [&] (size_t index) {
+        uint64_t segmentLow = low + index * SEGMENT_NUMBERS;
+        uint64_t segmentHigh = high - segmentLow < SEGMENT_NUMBERS ? high : segmentLow + SEGMENT_NUMBERS - 1;
+        return consume(factorSegment(segmentLow, segmentHigh, divisors));
+    });
+    return futures.get();
+}
+
+// Factorises [low, high] on the pool like factorRange(), but calls visit(result) on the calling thread with each
+// segment's consume(segment) in order, as soon as it and the segments before it are done. Segment k is only submitted
+// once segment k - SEGMENTS_PER_THREAD * threads has been visited, so the results held at a time stay bounded however
+// long the range is. Waits on the pool, so call it from outside the pool's tasks.
+template <typename Consume, typename Visit>
+void forEachSegment(BS::thread_pool &pool, uint64_t low, uint64_t high, Consume consume, Visit visit){
+    using Result = std::invoke_result_t<Consume&, const FactorSegment&>;
+    if(high < low){ return; }
+    size_t segments = (size_t)((high - low) / SEGMENT_NUMBERS + 1);
+    const size_t window = SEGMENTS_PER_THREAD * pool.get_thread_count();
+    const std::vector<primality::SmallDivisor> divisors = baseDivisors(high);
+    std::deque<std::future<Result>> inFlight;  // oldest first
+    size_t next = 0;
+    auto submit = [&] {
+        inFlight.push_back(pool.submit_task([&, index = next] {
+            uint64_t segmentLow = low + index * SEGMENT_NUMBERS;
+            uint64_t segmentHigh = high - segmentLow < SEGMENT_NUMBERS ? high : segmentLow + SEGMENT_NUMBERS - 1;
+            return consume(factorSegment(segmentLow, segmentHigh, divisors));
+        }));
+        next++;
+    };
+    try {
+        while(next < segments && inFlight.size() < window){ submit(); }
+        while(!inFlight.empty()){
+            Result result = inFlight.front().get();
+            inFlight.pop_front();
+            if(next < segments){ submit(); }
+            visit(std::move(result));
+        }
+    } catch(...){
+        for(std::future<Result> &future : inFlight){ future.wait(); }  // they still use divisors and consume
+        throw;
+    }
+}
+
+} // namespace factorsieve
+
+#endif
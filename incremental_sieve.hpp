@@ -0,0 +1,99 @@
+#ifndef INCREMENTAL_SIEVE_HPP
+#define INCREMENTAL_SIEVE_HPP
+
+/**
+ * A segmented sieve that can be extended to a higher limit without sieving again what it has already covered.
+ *
+ * The sieve keeps two things between extensions: its base primes, and the aggregated report (count, sum, largest
+ * primes and whichever statistics were asked for) of [0, limit]. Extending to a new limit sieves only the tail
+ * (limit, newLimit] in segments on the pool, reduces the tail's segment reports in the pool's tree and merges the
+ * result onto the stored report with the same associative merge the segments use, so constellations and gaps that
+ * straddle the old limit are stitched like any other segment boundary. The cost of an extension is the cost of the
+ * tail, plus growing the base primes when sqrt(newLimit) passes the old base limit; the base limit at least
+ * doubles each time, and the new base primes are sieved with the ones already known, from the old base limit up.
+ *
+ * No per-prime next-multiple state is carried over: the tail's segments are sieved in parallel, and each one finds
+ * its first multiple of every base prime with one division, which is what it would cost to look it up.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "BS_thread_pool.hpp"
+#include "segmented_sieve.hpp"
+#include "sieve_analysis.hpp"
+
+namespace incrementalsieve {
+
+class IncrementalSieve {
+public:
+    explicit IncrementalSieve(const segsieve::SieveConfig &config, const sieveanalysis::AnalysisOptions &options = {})
+        : config(config), options(options) {}
+
+    // Extends the sieve to cover [0, newLimit] and returns the report of all of it. A limit at or below the current
+    // one changes nothing. Waits on the pool, so call it from outside the pool's tasks.
+    const sieveanalysis::RangeReport& extendTo(BS::thread_pool &pool, uint64_t newLimit){
+        if(sieved && newLimit <= covered){ return total; }
+        uint64_t low = sieved ? covered + 1 : 0;
+        growBasePrimes(segsieve::integerSqrt(newLimit));
+        total = sieveanalysis::mergeReports(std::move(total), sieveTail(pool, low, newLimit));
+        covered = newLimit;
+        sieved = true;
+        return total;
+    }
+
+    bool empty() const { return !sieved; }
+    uint64_t limit() const { return covered; }
+    const sieveanalysis::RangeReport& report() const { return total; }
+    uint64_t basePrimeLimit() const { return baseLimit; }
+
+private:
+    // Makes sure basePrimes holds every prime up to root.
+    void growBasePrimes(uint64_t root){
+        if(root <= baseLimit && !basePrimes.empty()){ return; }
+        root = std::max(root, 2 * baseLimit);
+        if(segsieve::integerSqrt(root) > baseLimit){  // the known primes cannot sieve that far
+            basePrimes = segsieve::simpleSieve(root);
+            baseLimit = root;
+            return;
+        }
+        uint64_t low = (baseLimit + 1) & ~1ULL;
+        std::vector<uint64_t> words((root - low) / 128 + 1);
+        segsieve::sieveSegment(words.data(), low, root, basePrimes, segsieve::wheelPattern(config.wheel));
+        segsieve::SegmentView{words.data(), (size_t)((root - low + 1) / 2), low, root, false}.forEachPrime([&] (uint64_t prime) {
+            if(prime > baseLimit){ basePrimes.push_back((uint32_t)prime); }
+        });
+        baseLimit = root;
+    }
+
+    // The report of [low, high] alone, sieved with the stored base primes.
+    sieveanalysis::RangeReport sieveTail(BS::thread_pool &pool, uint64_t low, uint64_t high){
+        size_t segments = segsieve::segmentCount(low, high, config);
+        if(segments == 0){ return {}; }
+        const uint64_t span = segsieve::segmentSpan(config);
+        primeresidues::ResidueAccumulator residues(pool.get_thread_count(), options.residueModulus);
+        sieveanalysis::RangeReport report = pool.submit_reduce<size_t>(0, segments, [&] (size_t index) {
+            uint64_t segmentLow = (low & ~1ULL) + index * span;
+            uint64_t segmentHigh = std::min(high, segmentLow + span - 1);
+            uint64_t* buffer = segsieve::segmentBuffer(span / 128 + 1);
+            segsieve::sieveSegment(buffer, segmentLow, segmentHigh, basePrimes, segsieve::wheelPattern(config.wheel));
+            segsieve::SegmentView segment{buffer, (size_t)((segmentHigh - segmentLow + 1) / 2), segmentLow, segmentHigh,
+                                          index == 0 && low <= 2 && high >= 2};
+            return sieveanalysis::analyzeSegment(segment, options, residues);
+        }, sieveanalysis::mergeReports).get();
+        report.residues = residues.collect();
+        return report;
+    }
+
+    segsieve::SieveConfig config;
+    sieveanalysis::AnalysisOptions options;
+    std::vector<uint32_t> basePrimes;
+    uint64_t baseLimit = 0;
+    uint64_t covered = 0;
+    bool sieved = false;
+    sieveanalysis::RangeReport total;
+};
+
+} // namespace incrementalsieve
+
+#endif
@@ -4,25 +4,105 @@
 #include <cmath>
 #include <fstream>
 #include <chrono>
+#include <string>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include "sieve_profiler.hpp"
 #include "BS_thread_pool.hpp"
+#include "perf_counters.hpp"
+#include "sieve_verify.hpp"
+#include "segmented_sieve.hpp"
+#include "autotune.hpp"
+#include "sieve_arena.hpp"
+#include "shared_bitmap.hpp"
+#include "sieve_shard.hpp"
+#include "sieve_checkpoint.hpp"
+#include "prime_count.hpp"
+#include "prime_tail.hpp"
+#include "primality.hpp"
+#include "factor_sieve.hpp"
+#include "sieve_analysis.hpp"
+#include "incremental_sieve.hpp"
+#include "range_planner.hpp"
+#include "memory_budget.hpp"
+#include "sieve_engines.hpp"
+#include "sieve_server.hpp"
+#include "sieve_load.hpp"
+#include <random>
 #include <future>
 
 using namespace std;
 
 const int MAX_THREADS = 8;
 const int MAX_PRIME = 100000000;
+const char* PROFILE_TRACE_FILE = "sieve_trace.json";  // only written when built with -DSIEVE_PROFILE
 BS::thread_pool THREAD_POOL(MAX_THREADS);
 
+// Chunks and prime lists are drawn from the pre-faulted arena instead of the heap (see sieve_arena.hpp).
+using ChunkBits = vector<bool, sievearena::Allocator<bool>>;
+using PrimeList = vector<long long, sievearena::Allocator<long long>>;
+
 
 /**
  * This program calculates the prime numbers up to a given number using the Sieve of Eratosthenes algorithm.
- * 
+ *
  * The program uses a multithreaded approach to calculate the prime numbers.
  * https://en.wikipedia.org/wiki/Sieve_of_Eratosthenes
  */
 
 
-void sieveValue(vector<bool> &primes, int i, int threadNum){
+struct ChunkLayout {
+
+    // Describes how the numbers 0..limit are split into chunks, one task per chunk.
+    // Every chunk covers chunkSize numbers except the last one, which runs up to and including limit.
+
+    int limit;
+    int chunks;
+    int chunkSize;
+
+    int start(int chunk) const { return chunk * chunkSize; }
+    int end(int chunk) const { return chunk == chunks - 1 ? limit + 1 : (chunk + 1) * chunkSize; }
+    int baseLimit() const { return (int)sqrtl(limit); }
+};
+
+ChunkLayout makeChunkLayout(int limit, int chunks){
+
+    // A chunk has to start on an even number so that index (value - start) / 2 walks the odd values in order,
+    // and the first chunk has to contain every base prime up to sqrt(limit), since initialSieve reads them from it.
+    // Small limits therefore get fewer chunks than requested.
+
+    int baseLimit = (int)sqrtl(limit);
+    int smallestChunk = max(baseLimit + 2, 1024);
+    chunks = max(1, min(chunks, (limit + 1) / smallestChunk));
+    int chunkSize = ((limit + 1) / chunks) & ~1;
+    return {limit, chunks, chunkSize};
+}
+
+size_t maxPrimesBetween(long long start, long long end){
+
+    // Upper bound on the number of primes in [start, end), from pi(x) < 1.25506 x / ln x and pi(x) > x / ln x (x >= 17),
+    // used to size the prime lists so they never grow.
+
+    double upper = end > 1 ? 1.25506 * end / log((double)end) + 2 : 2;
+    double lower = start >= 17 ? start / log((double)start) : 0;
+    return (size_t)max(0.0, upper - lower) + 8;
+}
+
+size_t wheelArenaBytes(const ChunkLayout &layout){
+
+    // Everything the wheel pipeline allocates per chunk: the bits of the odd numbers and the list of primes with its sum.
+
+    size_t bytes = 0;
+    for(int i = 0; i < layout.chunks; i++){
+        size_t bits = (layout.end(i) - layout.start(i)) / 2 + 1;
+        bytes += sievearena::roundUp(bits / 8 + sizeof(unsigned long), sievearena::CACHE_LINE);
+        bytes += sievearena::roundUp((maxPrimesBetween(layout.start(i), layout.end(i)) + 1) * sizeof(long long), sievearena::CACHE_LINE);
+    }
+    return bytes + sievearena::PAGE_SIZE;
+}
+
+void sieveValue(vector<bool> &primes, int i, int baseLimit){
 
     // This function will iterate through the wheeled values only using the difference between the numbers to traverse through.
     // This avoids checking multiples of 2, 3, and 5 altogether.
@@ -32,7 +112,7 @@ void sieveValue(vector<bool> &primes, int i, int threadNum){
     int wheelValue = 7;
     int value = (i*2)+1;
     int j = value * value;
-    while (j < sqrt(MAX_PRIME)) {
+    while (j <= baseLimit) {
         primes[(j-1)/2] = false;
         wheelValue += offsets[count % 8];
         j = (value * wheelValue);
@@ -40,7 +120,7 @@ void sieveValue(vector<bool> &primes, int i, int threadNum){
     }
 }
 
-vector<int> initialSieve(vector<bool> &primes){
+vector<int> initialSieve(vector<bool> &primes, int baseLimit){
 
     // Sieve up to the square root of the max prime to find the primes, then use those primes to sieve the rest of the numbers.
     // This function will iterate through the wheeled values only using the difference between the numbers to traverse through.
@@ -51,79 +131,95 @@ vector<int> initialSieve(vector<bool> &primes){
     vector<int> offsets = {4, 2, 4,  2,  4,  6,  2,  6};
     vector<int> intPrimeVector = {2, 3, 5};
     int index = -1;
-    int limit = sqrt(MAX_PRIME);
-    for(int i = 7; i < limit; i+=offsets[index % 8]){
+    for(int i = 7; i <= baseLimit; i+=offsets[index % 8]){
         if(primes[i/2]){
             intPrimeVector.push_back(i);
-            sieveValue(primes, i/2, 0);
+            sieveValue(primes, i/2, baseLimit);
         }
        index++;
     }
     return intPrimeVector;
 }
 
-void chunkSieve(vector<bool> &wheel, vector<int> &primes, int threadID){
+void chunkSieve(ChunkBits &wheel, vector<int> &primes, int threadID, const ChunkLayout &layout){
 
     // This function will iterate through the wheeled values only using the difference between the numbers to traverse through.
     // It accounts for split up chunks of the wheel, so each thread will only calculate a portion of the wheel.
 
+    SIEVE_PROFILE_PHASE("chunkSieve");
+    perfcounters::ScopedCounters counters("chunkSieve");
+    SIEVE_PROFILE_LOCAL_COUNTER(crossedOff);
     vector<int> offsets = {4, 2, 4, 2, 4, 6, 2, 6};
     unordered_map<int, int> wheelLookup = {{1, 0}, {7, 1}, {11, 2}, {13, 3}, {17, 4}, {19, 5}, {23, 6}, {29, 7}}; // to get the index of the offset
-    int end = min((threadID + 1) * (MAX_PRIME / MAX_THREADS), MAX_PRIME);
-    
+    int chunkStart = layout.start(threadID);
+    int end = layout.end(threadID);
+
     for(auto it = primes.begin() + 3; it != primes.end(); ++it){  // Skip checking 2, 3, and 5
         int prime = *it;
-        int start = ((((threadID) * (MAX_PRIME / MAX_THREADS) + (prime - 1))/prime)*prime);  // get first divisible by prime number
+        int start = ((chunkStart + (prime - 1))/prime)*prime;  // get first divisible by prime number
         if (start % 2 == 0) { start += prime; }  // make sure it is odd
         if (threadID == 0) { start = prime * prime; }  // start at prime squared if thread 0
 
         while (wheelLookup.find(start % 30) == wheelLookup.end()){
             start += prime * 2;
         }
-        if(start > end){ break; }  // skip if start is greater than end
-        
+        if(start >= end){ continue; }  // no multiple of this prime in the chunk, but a larger prime may still have one
+
         int wheelValue = start / prime;
         int index = wheelLookup[wheelValue % 30] + 7;
 
         while (wheelValue * prime < end){
-            wheel[(wheelValue * prime - (threadID * (MAX_PRIME / MAX_THREADS))) / 2] = false;
+            wheel[(wheelValue * prime - chunkStart) / 2] = false;
+            SIEVE_PROFILE_INCREMENT(crossedOff);
             wheelValue += offsets[index % 8];
             index++;
         }
     }
+    SIEVE_PROFILE_COUNT("crossed off bits", crossedOff);
 }
 
-void sieveVector(vector<vector<bool>> &wheel){
+vector<int> basePrimes(const ChunkBits &firstChunk, const ChunkLayout &layout){
+
+    // The primes up to the square root of the limit, sieved from a copy of the first chunk's wheel values.
+
+    SIEVE_PROFILE_PHASE("initialSieve");
+    perfcounters::ScopedCounters counters("initialSieve");
+    int baseLimit = layout.baseLimit();
+    vector<bool> wheelSubset = {firstChunk.begin(), firstChunk.begin() + baseLimit / 2 + 1};
+    return initialSieve(wheelSubset, baseLimit);
+}
+
+void sieveVector(vector<ChunkBits> &wheel, const ChunkLayout &layout){
 
     // We will sieve up to the square root of MAX_PRIME, so we can get all prime numbers up to that number and use those to sieve
     // This works since all non-prime numbers have a prime factor less than or equal to the square root of the number.
 
-    vector<bool> wheelSubset = {wheel[0].begin(), wheel[0].begin() + (sqrt(MAX_PRIME) / 2) - 1};
-    vector<int> primes = initialSieve(wheelSubset);
-    
-    for(int i = 0; i < MAX_THREADS; i++){
-        THREAD_POOL.detach_task([=, &wheel, &primes] () {
-            chunkSieve(ref(wheel[i]), ref(primes), i);
+    vector<int> primes = basePrimes(wheel[0], layout);
+    for(int i = 0; i < layout.chunks; i++){
+        THREAD_POOL.detach_task([=, &wheel, &primes, &layout] () {
+            chunkSieve(ref(wheel[i]), ref(primes), i, layout);
         });
     }
     THREAD_POOL.wait();
 }
 
-vector<bool> individualWheelValue(int startValue, int endValue){
+ChunkBits individualWheelValue(int startValue, int endValue){
 
     // This function will calculate the wheel values for a specific chunk of the wheel.
     // It will only calculate the values that are part of the wheel, skipping multiples of 2, 3, and 5.
 
+    SIEVE_PROFILE_PHASE("individualWheelValue");
+    perfcounters::ScopedCounters counters("individualWheelValue");
     vector<int> offsets = {4, 2, 4,  2,  4,  6,  2,  6};
     unordered_map<int, int> wheelLookup = {{1, 0}, {7, 1}, {11, 2}, {13, 3}, {17, 4}, {19, 5}, {23, 6}, {29, 7}}; // to get the index of the offset
-    vector<bool> wheel((endValue - startValue)/2 + 1, false);
+    ChunkBits wheel((endValue - startValue)/2 + 1, false);
 
     int value = startValue;
 
     // Finds next value that will be part of the wheel. Useful if you start, for example, at 1250, which is not part of the wheel.
     // This is needed since the calculations are split between 8 chunks.
 
-    while (wheelLookup.find(value % 30) == wheelLookup.end()) { value++; }  
+    while (wheelLookup.find(value % 30) == wheelLookup.end()) { value++; }
     int index = wheelLookup[value % 30] + 7;
 
     while(value < endValue){  // calculate the wheel values
@@ -134,19 +230,28 @@ vector<bool> individualWheelValue(int startValue, int endValue){
     return wheel;
 }
 
-void wheelFactorization(vector<vector<bool>> &wheel){
-    vector<future<vector<bool>>> futures;
-    futures.reserve(MAX_THREADS);
-    wheel.reserve(MAX_THREADS);
+void markSmallPrimes(ChunkBits &firstChunk){
+
+    // Add primes 3 and 5 to the wheel, which skips them. No need for 2, since we only store odd numbers.
+
+    firstChunk[0] = false; // 1 is not prime.
+    firstChunk[1] = true;  // 3 is prime.
+    firstChunk[2] = true;  // 5 is prime.
+}
 
-    // Split the vector into 8 vectors, each for a thread to run the wheel, following the pattern 4 2 4 2 4 6 2 6.
+void wheelFactorization(vector<ChunkBits> &wheel, const ChunkLayout &layout){
+    vector<future<ChunkBits>> futures;
+    futures.reserve(layout.chunks);
+    wheel.reserve(layout.chunks);
+
+    // Split the vector into one vector per chunk, each for a thread to run the wheel, following the pattern 4 2 4 2 4 6 2 6.
     // This pattern is the difference between 1, 7, 11, 13, 17, 19, 23, 29, which are the first 8 values of the wheel.
     // These values are obtained by removing all multiples of 2, 3, and 5 from the numbers between 1 and 30.
     // We use 30 since the wheel removes multiples of 2, 3, and 5. 2 * 3 * 5 = 30. Our wheel is mod 30.
 
-    for(int i = 0; i < MAX_THREADS; i++){
-        int start = i * (MAX_PRIME / MAX_THREADS);
-        int end = min((i + 1) * (MAX_PRIME / MAX_THREADS), MAX_PRIME);
+    for(int i = 0; i < layout.chunks; i++){
+        int start = layout.start(i);
+        int end = layout.end(i);
         futures.push_back(THREAD_POOL.submit_task([=] () {
             return individualWheelValue(start, end);
         }));
@@ -156,20 +261,20 @@ void wheelFactorization(vector<vector<bool>> &wheel){
     for(auto &future : futures){
         wheel.push_back(future.get());
     }
-    
-    // Then, add primes 3 and 5 to the wheel. No need for 2, since we only store even numbers.
-    wheel[0][0] = false; // 1 is not prime.
-    wheel[0][1] = true;  // 3 is prime.
-    wheel[0][2] = true;  // 5 is prime.
+
+    markSmallPrimes(wheel[0]);
 }
 
-vector<long long> boolToIntVector(vector<bool> &primes, int threadID){
+PrimeList boolToIntVector(ChunkBits &primes, int threadID, const ChunkLayout &layout){
 
     // This function converts the bool vector to an int vector, then adds the sum of the primes to the end of the vector.
     // It is optimized for multithreading, so each thread will only calculate a portion of the wheel.
     // It will only calculate the values that are part of the wheel, skipping multiples of 2, 3, and 5.
 
-    vector<long long> intPrimes;
+    SIEVE_PROFILE_PHASE("boolToIntVector");
+    perfcounters::ScopedCounters counters("boolToIntVector");
+    PrimeList intPrimes;
+    intPrimes.reserve(maxPrimesBetween(layout.start(threadID), layout.end(threadID)) + 1);  // one allocation, so nothing is left behind in the arena
     vector<int> offsets = {4, 2, 4, 2, 4, 6, 2, 6};
     unordered_map<int, int> wheelLookup = {{1, 0}, {7, 1}, {11, 2}, {13, 3}, {17, 4}, {19, 5}, {23, 6}, {29, 7}};
     int firstPrimeInChunk = 0;
@@ -180,15 +285,19 @@ vector<long long> boolToIntVector(vector<bool> &primes, int threadID){
         sum = 2 + 3 + 5;  // also add the sum of the first 3 primes.
         firstPrimeInChunk = 7;  // start at 7, since 2, 3, 5 are already added.
     } else { // find the first prime in this chunk.
-        while(!primes[firstPrimeInChunk]){ firstPrimeInChunk++; }  // find the index of first prime in the chunk
-        firstPrimeInChunk = ((firstPrimeInChunk * 2) + 1) + (threadID * (MAX_PRIME / MAX_THREADS));  // now, convert to value
+        while(firstPrimeInChunk < (int)primes.size() && !primes[firstPrimeInChunk]){ firstPrimeInChunk++; }  // find the index of first prime in the chunk
+        if(firstPrimeInChunk == (int)primes.size()){  // a chunk with no primes at all, only possible for tiny chunks
+            intPrimes.push_back(sum);
+            return intPrimes;
+        }
+        firstPrimeInChunk = ((firstPrimeInChunk * 2) + 1) + layout.start(threadID);  // now, convert to value
     }
-    
+
     int index = wheelLookup[firstPrimeInChunk % 30] + 7;
-    int end = min((threadID + 1) * (MAX_PRIME / MAX_THREADS), MAX_PRIME);
+    int end = layout.end(threadID);
 
     while (firstPrimeInChunk < end){
-        if(primes[(firstPrimeInChunk - (threadID * (MAX_PRIME / MAX_THREADS))) / 2]){
+        if(primes[(firstPrimeInChunk - layout.start(threadID)) / 2]){
             sum += firstPrimeInChunk;
             intPrimes.push_back(firstPrimeInChunk);
         }
@@ -199,40 +308,1272 @@ vector<long long> boolToIntVector(vector<bool> &primes, int threadID){
     return intPrimes;
 }
 
-int main(int argc, char** argv){
-    vector<vector<bool>> wheel;
-    auto begin = chrono::steady_clock::now(); // Starting time
-    wheelFactorization(wheel);
-    sieveVector(wheel);
-    vector<future<vector<long long>>> primes;
-    vector<vector<long long>> primeVector;
-    primes.reserve(MAX_THREADS);
-    primeVector.reserve(MAX_THREADS);
-    for(int i = 0; i < MAX_THREADS; i++){
-        primes.push_back(THREAD_POOL.submit_task([=, &wheel] () {
-            return boolToIntVector(wheel[i], i);
+vector<PrimeList> wheelSieve(int limit, int chunks){
+
+    // Runs the whole pipeline for the primes up to and including limit (at least 10), split into the given number of chunks.
+    // Returns one vector per chunk, holding that chunk's primes in order followed by their sum.
+
+    ChunkLayout layout = makeChunkLayout(limit, chunks);
+    vector<ChunkBits> wheel;
+    {
+        SIEVE_PROFILE_PHASE("wheelFactorization");
+        perfcounters::ScopedCounters counters("wheelFactorization");
+        wheelFactorization(wheel, layout);
+    }
+    {
+        SIEVE_PROFILE_PHASE("sieveVector");
+        perfcounters::ScopedCounters counters("sieveVector");
+        sieveVector(wheel, layout);
+    }
+    vector<future<PrimeList>> primes;
+    vector<PrimeList> primeVector;
+    primes.reserve(layout.chunks);
+    primeVector.reserve(layout.chunks);
+    for(int i = 0; i < layout.chunks; i++){
+        primes.push_back(THREAD_POOL.submit_task([=, &wheel, &layout] () {
+            return boolToIntVector(wheel[i], i, layout);
         }));
     }
-    for(auto &prime : primes){
-        primeVector.push_back(prime.get());
+    {
+        SIEVE_PROFILE_PHASE("collectResults");
+        perfcounters::ScopedCounters counters("collectResults");
+        for(auto &prime : primes){
+            primeVector.push_back(prime.get());
+        }
     }
-    auto time = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count(); // Ending time
+    return primeVector;
+}
 
-    long long sum = 0;
-    int count = 0;
-    for(int i = 0; i < primeVector.size(); i++){
-        sum += primeVector[i].back();
-        count += primeVector[i].size() - 1;
+vector<PrimeList> wheelSieveGraph(int limit, int chunks){
+
+    // The same pipeline as wheelSieve, run as a task graph instead of phases with a barrier between them: a chunk is
+    // sieved as soon as its own wheel values and the base primes are ready, and converted to a list as soon as it is
+    // sieved, on the thread that sieved it. No thread waits for the slowest chunk of the previous phase.
+
+    ChunkLayout layout = makeChunkLayout(limit, chunks);
+    vector<ChunkBits> wheel(layout.chunks);
+    vector<int> primes;
+    vector<PrimeList> primeVector(layout.chunks);
+    BS::task_graph graph(THREAD_POOL);
+    vector<BS::task_graph::node> values;
+    for(int i = 0; i < layout.chunks; i++){
+        values.push_back(graph.add([&, i] () {
+            wheel[i] = individualWheelValue(layout.start(i), layout.end(i));
+            if(i == 0){ markSmallPrimes(wheel[0]); }
+        }));
+    }
+    BS::task_graph::node base = graph.then(values[0], [&] () { primes = basePrimes(wheel[0], layout); });
+    for(int i = 0; i < layout.chunks; i++){
+        BS::task_graph::node sieved = graph.add([&, i] () { chunkSieve(wheel[i], primes, i, layout); }, {values[i], base});
+        graph.then(sieved, [&, i] () { primeVector[i] = boolToIntVector(wheel[i], i, layout); });
+    }
+    {
+        SIEVE_PROFILE_PHASE("taskGraph");
+        perfcounters::ScopedCounters counters("taskGraph");
+        graph.run().get();
+    }
+    return primeVector;
+}
+
+segsieve::PrimeSummary chunkSummary(const PrimeList &chunk){
+
+    // Count, sum and largest primes of one chunk's list from boolToIntVector, whose last entry is the chunk's sum.
+
+    segsieve::PrimeSummary summary;
+    summary.count = chunk.size() - 1;
+    summary.sum = (uint64_t)chunk.back();
+    summary.largest.assign(chunk.end() - 1 - min<size_t>(summary.count, segsieve::TOP_PRIMES), chunk.end() - 1);
+    return summary;
+}
+
+struct Options {
+    string engine = "wheel";   // "wheel" (the chunked pipeline above), "segmented", "shared" or "lucy" (count and sum only)
+    uint64_t limit = MAX_PRIME;
+    segsieve::SieveConfig config;
+    int repeat = 1;            // run the sieve this many times in one process and report the fastest
+    bool autotune = false;
+    bool verify = false;
+    unsigned shard = 0;        // with shards > 0, sieve only shard `shard` of `shards` and write a partial result
+    unsigned shards = 0;
+    string partialPath;        // default shard-<i>-of-<n>.part
+    bool writeBitmap = false;  // also write the shard's bitmap to <partialPath>.bits
+    vector<string> mergeFiles; // --merge: combine these partial results instead of sieving
+    string bitmapOut;          // --merge: concatenate the shards' bitmaps into this file
+    string checkpointPath;     // segmented engine: write checkpoints here
+    double checkpointSeconds = 10;
+    bool resume = false;       // continue from the checkpoint instead of starting over
+    size_t tail = 0;           // --tail K: print the K largest primes up to the limit and nothing else
+    string neighbour;          // "prev" or "next" for --prev-prime / --next-prime
+    uint64_t neighbourOf = 0;
+    vector<uint64_t> primalityOf;  // --is-prime N...: test these with Miller-Rabin
+    size_t primalityBench = 0;     // --bench-primality COUNT: time a batch of random 64-bit numbers
+    string factorMode;             // "list" for --factor, "stats" for --factor-stats
+    uint64_t factorLow = 0;
+    uint64_t factorHigh = 0;
+    sieveanalysis::AnalysisOptions analysis;  // segmented engine: statistics gathered in the same pass
+    vector<uint64_t> limits;       // --limits A,B,...: one incremental sieve extended to each limit in turn
+    vector<rangeplanner::RangeQuery> ranges;  // --ranges A:B,...: answer these together with one planned sieve
+    bool separately = false;       // --separately: answer each of the ranges with its own sieve instead
+    bool barriers = false;         // wheel engine: run the pipeline phase by phase instead of as a task graph
+    uint32_t deadlineMs = 0;       // segmented engine: stop after this long and report the prefix sieved so far
+    size_t memoryBudgetMb = 0;     // --memory-budget MB: sieve within this much memory, a bounded number of segments at a time
+    string primesOut;              // --primes-out FILE: with --memory-budget, write every prime to FILE
+    vector<uint64_t> benchLimits;  // --bench-engines A,B,...: time every engine of sieve_engines.hpp at these limits
+    vector<unsigned> benchThreads; // --bench-threads T,...: and with these thread counts (default 1 and --threads)
+    string servePath;              // --serve SOCKET: answer queries on a Unix domain socket, indexing [0, limit]
+    string stopPath;               // --stop SOCKET: ask the server there to shut down
+    sieveload::LoadOptions load;   // --load SOCKET: run the load generator against a server
+};
+
+void printUsage(){
+
+    // On stderr, after the message saying what was wrong with the command line.
+
+    cerr << "usage: main.exe [--engine wheel|segmented|shared|lucy|eratosthenes|atkin|linear] [--limit N] [--threads T]" << endl;
+    cerr << "                [--segment-bytes B] [--wheel 2|30|210] [--bench-engines A,B,... [--bench-threads T,...]]" << endl;
+    cerr << "                [--repeat N] [--autotune] [--verify] [--perf] [--barriers] [--tuplets] [--gaps] [--residues Q]" << endl;
+    cerr << "                [--limits A,B,...] [--ranges LOW:HIGH,... [--separately]] [--deadline MS]" << endl;
+    cerr << "                [--memory-budget MB [--primes-out FILE]]" << endl;
+    cerr << "                [--serve SOCKET] [--stop SOCKET]" << endl;
+    cerr << "                [--load SOCKET [--load-clients C] [--load-batches N] [--load-batch B] [--load-deadline MS]]" << endl;
+    cerr << "                [--shard I/N [--partial FILE] [--bitmap]] [--merge FILE... [--bitmap-out FILE]]" << endl;
+    cerr << "                [--checkpoint FILE [--checkpoint-every SECONDS] [--resume]]" << endl;
+    cerr << "                [--tail K] [--prev-prime N] [--next-prime N] [--is-prime N...] [--bench-primality COUNT]" << endl;
+    cerr << "                [--factor LOW HIGH] [--factor-stats LOW HIGH]" << endl;
+}
+
+Options parseOptions(int argc, char** argv){
+
+    // Defaults first, then the tuned profile if there is one, then whatever was given on the command line.
+
+    Options options;
+    options.config.threads = MAX_THREADS;
+    autotune::loadProfile(autotune::PROFILE_FILE, options.config);
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(arg == "--perf"){ perfcounters::enabled() = true; }  // hardware counters per phase and thread
+        else if(arg == "--verify"){ options.verify = true; }
+        else if(arg == "--autotune"){ options.autotune = true; }
+        else if(arg == "--engine" && hasValue){ options.engine = argv[++i]; }
+        else if(arg == "--limit" && hasValue){ options.limit = stoull(argv[++i]); }
+        else if(arg == "--threads" && hasValue){ options.config.threads = max(1, stoi(argv[++i])); }
+        else if(arg == "--segment-bytes" && hasValue){ options.config.segmentBytes = stoull(argv[++i]); }
+        else if(arg == "--wheel" && hasValue){ options.config.wheel = stoi(argv[++i]); }
+        else if(arg == "--repeat" && hasValue){ options.repeat = max(1, stoi(argv[++i])); }
+        else if(arg == "--shard" && hasValue && sscanf(argv[i + 1], "%u/%u", &options.shard, &options.shards) == 2
+                && options.shard < options.shards){ i++; }
+        else if(arg == "--partial" && hasValue){ options.partialPath = argv[++i]; }
+        else if(arg == "--bitmap"){ options.writeBitmap = true; }
+        else if(arg == "--bitmap-out" && hasValue){ options.bitmapOut = argv[++i]; }
+        else if(arg == "--checkpoint" && hasValue){ options.checkpointPath = argv[++i]; }
+        else if(arg == "--checkpoint-every" && hasValue){ options.checkpointSeconds = stod(argv[++i]); }
+        else if(arg == "--resume"){ options.resume = true; }
+        else if(arg == "--tuplets"){ options.analysis.tuplets = true; }
+        else if(arg == "--gaps"){ options.analysis.gaps = true; }
+        else if(arg == "--residues" && hasValue){ options.analysis.residueModulus = stoull(argv[++i]); }
+        else if(arg == "--serve" && hasValue){ options.servePath = argv[++i]; }
+        else if(arg == "--stop" && hasValue){ options.stopPath = argv[++i]; }
+        else if(arg == "--load" && hasValue){ options.load.path = argv[++i]; }
+        else if(arg == "--load-clients" && hasValue){ options.load.clients = max(1, stoi(argv[++i])); }
+        else if(arg == "--load-batches" && hasValue){ options.load.batches = stoull(argv[++i]); }
+        else if(arg == "--load-batch" && hasValue){ options.load.batchSize = max<size_t>(1, min<size_t>(sieveserver::MAX_BATCH, stoull(argv[++i]))); }
+        else if(arg == "--bench-engines" && hasValue){
+            istringstream values(argv[++i]);
+            for(string value; getline(values, value, ',');){ options.benchLimits.push_back(stoull(value)); }
+        }
+        else if(arg == "--bench-threads" && hasValue){
+            istringstream values(argv[++i]);
+            for(string value; getline(values, value, ',');){ options.benchThreads.push_back(max(1, stoi(value))); }
+        }
+        else if(arg == "--limits" && hasValue){
+            istringstream values(argv[++i]);
+            for(string value; getline(values, value, ',');){ options.limits.push_back(stoull(value)); }
+        }
+        else if(arg == "--ranges" && hasValue){
+            istringstream values(argv[++i]);
+            for(string value; getline(values, value, ',');){
+                size_t colon = value.find(':');
+                if(colon == string::npos){
+                    cerr << "--ranges takes LOW:HIGH pairs separated by commas, got " << value << endl;
+                    exit(2);
+                }
+                options.ranges.push_back({stoull(value.substr(0, colon)), stoull(value.substr(colon + 1))});
+            }
+        }
+        else if(arg == "--separately"){ options.separately = true; }
+        else if(arg == "--barriers"){ options.barriers = true; }
+        else if(arg == "--memory-budget" && hasValue){ options.memoryBudgetMb = stoull(argv[++i]); }
+        else if(arg == "--primes-out" && hasValue){ options.primesOut = argv[++i]; }
+        else if(arg == "--deadline" && hasValue){ options.deadlineMs = stoul(argv[++i]); }
+        else if(arg == "--load-deadline" && hasValue){ options.load.deadlineMs = stoul(argv[++i]); }
+        else if(arg == "--tail" && hasValue){ options.tail = stoull(argv[++i]); }
+        else if((arg == "--prev-prime" || arg == "--next-prime") && hasValue){
+            options.neighbour = arg.substr(2, 4);
+            options.neighbourOf = stoull(argv[++i]);
+        }
+        else if(arg == "--is-prime"){
+            while(i + 1 < argc && string(argv[i + 1]).rfind("--", 0) != 0){ options.primalityOf.push_back(stoull(argv[++i])); }
+        }
+        else if(arg == "--bench-primality" && hasValue){ options.primalityBench = stoull(argv[++i]); }
+        else if((arg == "--factor" || arg == "--factor-stats") && i + 2 < argc){
+            options.factorMode = arg == "--factor" ? "list" : "stats";
+            options.factorLow = stoull(argv[++i]);
+            options.factorHigh = stoull(argv[++i]);
+        }
+        else if(arg == "--merge"){
+            while(i + 1 < argc && string(argv[i + 1]).rfind("--", 0) != 0){ options.mergeFiles.push_back(argv[++i]); }
+        }
+        else {
+            cerr << "unknown option " << arg << endl;
+            printUsage();
+            exit(2);
+        }
+    }
+    bool knownEngine = options.engine == "wheel" || options.engine == "segmented" || options.engine == "shared" || options.engine == "lucy"
+                    || find(begin(sieveengines::ENGINE_NAMES), end(sieveengines::ENGINE_NAMES), options.engine) != end(sieveengines::ENGINE_NAMES);
+    if(!knownEngine){
+        cerr << "unknown engine " << options.engine << endl;
+        printUsage();
+        exit(2);
+    }
+    if(options.config.wheel != 2 && options.config.wheel != 30 && options.config.wheel != 210){
+        cerr << "--wheel takes 2, 30 or 210, got " << options.config.wheel << endl;
+        printUsage();
+        exit(2);
+    }
+    if(options.resume && options.checkpointPath.empty()){ options.checkpointPath = "sieve_checkpoint.txt"; }
+    return options;
+}
+
+void addWheelModes(vector<sieveverify::VerifyMode> &modes){
+
+    // The wheel pipeline, barriers and task graph, at chunk counts that do and do not divide the range.
+
+    for(int chunks : {1, 2, 3, 7, MAX_THREADS, 13, -1, -3, -MAX_THREADS}){  // negative: the task graph with that many chunks
+        sieveverify::VerifyMode mode;
+        mode.name = (chunks > 0 ? "wheel/" : "wheel graph/") + to_string(abs(chunks)) + " chunks";
+        mode.minLimit = 10;
+        mode.maxLimit = MAX_PRIME;
+        mode.listPrimes = [chunks] (uint64_t low, uint64_t high) {
+            vector<uint64_t> result;
+            for(PrimeList &chunk : chunks > 0 ? wheelSieve((int)high, chunks) : wheelSieveGraph((int)high, -chunks)){
+                for(auto it = chunk.begin(); it != chunk.end() - 1; ++it){  // the last entry is the chunk's sum
+                    if((uint64_t)*it >= low){ result.push_back(*it); }
+                }
+            }
+            return result;
+        };
+        modes.push_back(mode);
+    }
+}
+
+void addSegmentedModes(vector<sieveverify::VerifyMode> &modes){
+
+    // Small segments put many segment boundaries inside every test range.
+
+    for(segsieve::SieveConfig config : {segsieve::SieveConfig{MAX_THREADS, 64, 2}, segsieve::SieveConfig{MAX_THREADS, 200, 30},
+                                        segsieve::SieveConfig{MAX_THREADS, 4096, 210}, segsieve::SieveConfig{MAX_THREADS, 32768, 30}}){
+        sieveverify::VerifyMode mode;
+        mode.name = "segmented/" + to_string(config.segmentBytes) + " B wheel " + to_string(config.wheel);
+        mode.maxLimit = config.segmentBytes >= 4096 ? MAX_PRIME : 10000000;
+        mode.supportsRanges = true;
+        mode.listPrimes = [config] (uint64_t low, uint64_t high) {
+            return segsieve::listPrimes(THREAD_POOL, low, high, config);
+        };
+        mode.countPrimes = [config] (uint64_t limit) {
+            segsieve::PrimeSummary summary = segsieve::summarizeRange(THREAD_POOL, 0, limit, config);
+            return sieveverify::PrimeTotals{summary.count, (uint64_t)summary.sum};
+        };
+        modes.push_back(mode);
+    }
+}
+
+void addSharedModes(vector<sieveverify::VerifyMode> &modes){
+
+    // 4096 bytes gives cache-line aligned segments sieved in place; 100 bytes puts segment boundaries inside words,
+    // which exercises the atomic merge.
+
+    for(uint64_t segmentBytes : {4096, 100}){
+        segsieve::SieveConfig config{MAX_THREADS, segmentBytes, 30};
+        sieveverify::VerifyMode mode;
+        mode.name = "shared/" + to_string(segmentBytes) + " B";
+        mode.maxLimit = segmentBytes >= 4096 ? MAX_PRIME : 10000000;
+        mode.listPrimes = [config] (uint64_t low, uint64_t high) {
+            sharedbitmap::SharedBitmap bitmap;
+            bitmap.build(THREAD_POOL, high, config);
+            vector<uint64_t> primes;
+            bitmap.view(low, high).forEachPrime([&] (uint64_t prime) {
+                if(prime >= low && prime <= high){ primes.push_back(prime); }
+            });
+            return primes;
+        };
+        mode.countPrimes = [config] (uint64_t limit) {
+            sharedbitmap::SharedBitmap bitmap;
+            bitmap.build(THREAD_POOL, limit, config);
+            segsieve::PrimeSummary summary = bitmap.summarize(THREAD_POOL);
+            return sieveverify::PrimeTotals{summary.count, (uint64_t)summary.sum};
+        };
+        modes.push_back(mode);
+    }
+}
+
+void addShardModes(vector<sieveverify::VerifyMode> &modes){
+
+    // Shards sieved one after the other, each partial result written out and read back, then merged; the primes
+    // are read from the shards' bitmaps laid end to end, the way --merge --bitmap-out concatenates them. Segments of
+    // 100 bytes are 12.5 words long, so neighbouring segments share a word of the shard's bitmap.
+
+    for(pair<unsigned, uint64_t> run : {pair<unsigned, uint64_t>{1, 64}, {3, 64}, {5, 64}, {3, 100}}){
+        unsigned shards = run.first;
+        segsieve::SieveConfig config{MAX_THREADS, run.second, 30};
+        auto mergeShards = [config, shards] (uint64_t limit, string *bitmap) {
+            vector<sieveshard::PartialResult> parts;
+            unsigned usable = (unsigned)min<uint64_t>(shards, segsieve::segmentCount(0, limit, config));
+            for(unsigned shard = 0; shard < usable; shard++){
+                ostringstream bits, written;
+                sieveshard::PartialResult result = sieveshard::sieveShard(THREAD_POOL, limit, shard, usable, config, &bits);
+                result.bitmapPath = "(in memory)";
+                sieveshard::writePartial(written, result);
+                istringstream read(written.str());
+                sieveshard::PartialResult part;
+                sieveshard::readPartial(read, part);
+                parts.push_back(part);
+                if(bitmap != nullptr){ *bitmap += bits.str(); }
+            }
+            sieveshard::PartialResult merged;
+            sieveshard::mergePartials(parts, merged, cerr);
+            return merged;
+        };
+        sieveverify::VerifyMode mode;
+        mode.name = "sharded/" + to_string(shards) + " shards of " + to_string(config.segmentBytes) + " B segments";
+        mode.maxLimit = 10000000;
+        mode.listPrimes = [mergeShards] (uint64_t low, uint64_t high) {
+            string bitmap;
+            sieveshard::PartialResult merged = mergeShards(high, &bitmap);
+            vector<uint64_t> words(bitmap.size() / sizeof(uint64_t));
+            memcpy(words.data(), bitmap.data(), words.size() * sizeof(uint64_t));
+            vector<uint64_t> primes;
+            segsieve::SegmentView{words.data(), (size_t)((high + 1) / 2), 0, high, high >= 2}.forEachPrime([&] (uint64_t prime) {
+                if(prime >= low){ primes.push_back(prime); }
+            });
+            return merged.bitmapWords == words.size() ? primes : vector<uint64_t>();
+        };
+        mode.countPrimes = [mergeShards] (uint64_t limit) {
+            sieveshard::PartialResult merged = mergeShards(limit, nullptr);
+            return sieveverify::PrimeTotals{merged.count, (uint64_t)merged.sum};
+        };
+        modes.push_back(mode);
+    }
+}
+
+void addCountModes(vector<sieveverify::VerifyMode> &modes){
+
+    // The combinatorial count, checked against the known values up to 10^10 and against the reference sieve.
+
+    sieveverify::VerifyMode mode;
+    mode.name = "lucy (count only)";
+    mode.maxLimit = 10000000000ULL;
+    mode.countPrimes = [] (uint64_t limit) {
+        primecount::Totals totals = primecount::countPrimes(THREAD_POOL, limit);
+        return sieveverify::PrimeTotals{totals.count, (uint64_t)totals.sum};
+    };
+    modes.push_back(mode);
+}
+
+void addTailModes(vector<sieveverify::VerifyMode> &modes){
+
+    // Tail queries, walked window by window across the whole test range.
+
+    sieveverify::VerifyMode mode;
+    mode.name = "tail/largest primes";
+    mode.maxLimit = MAX_PRIME;
+    mode.listPrimes = [] (uint64_t, uint64_t high) {
+        return primetail::largestPrimes(high, SIZE_MAX);
+    };
+    modes.push_back(mode);
+
+    mode.name = "tail/prevPrime";
+    mode.maxLimit = 10000000;
+    mode.supportsRanges = true;
+    mode.listPrimes = [] (uint64_t low, uint64_t high) {
+        vector<uint64_t> primes;
+        for(uint64_t prime = primetail::prevPrime(high + 1); prime >= low && prime != 0; prime = primetail::prevPrime(prime)){
+            primes.push_back(prime);
+        }
+        reverse(primes.begin(), primes.end());
+        return primes;
+    };
+    modes.push_back(mode);
+
+    mode.name = "tail/nextPrime";
+    mode.listPrimes = [] (uint64_t low, uint64_t high) {
+        vector<uint64_t> primes;
+        for(uint64_t prime = primetail::nextPrime(low == 0 ? 0 : low - 1); prime <= high; prime = primetail::nextPrime(prime)){
+            primes.push_back(prime);
+        }
+        return primes;
+    };
+    modes.push_back(mode);
+}
+
+void addPrimalityModes(vector<sieveverify::VerifyMode> &modes){
+
+    // Miller-Rabin on every number of the range, through the batch path (prefilter, lockstep base 2, remaining bases).
+
+    sieveverify::VerifyMode mode;
+    mode.name = "miller-rabin batch";
+    mode.maxLimit = 10000000;
+    mode.supportsRanges = true;
+    mode.listPrimes = [] (uint64_t low, uint64_t high) {
+        vector<uint64_t> numbers;
+        for(uint64_t n = low; n <= high; n++){ numbers.push_back(n); }
+        vector<char> prime = primality::isPrimeBatch(THREAD_POOL, numbers);
+        vector<uint64_t> primes;
+        for(size_t i = 0; i < numbers.size(); i++){
+            if(prime[i]){ primes.push_back(numbers[i]); }
+        }
+        return primes;
+    };
+    modes.push_back(mode);
+}
+
+vector<uint64_t> tupletCounts(const vector<uint64_t> &primes){
+
+    // The reference for the constellation counts: for each pattern, the primes p of the list whose other members
+    // p + 2j are in the list too.
+
+    vector<uint64_t> counts(primetuplets::PATTERN_COUNT);
+    for(uint64_t p : primes){
+        for(size_t k = 0; k < primetuplets::PATTERN_COUNT; k++){
+            bool all = true;
+            for(uint64_t j = 1; j < 64 && (primetuplets::PATTERNS[k].offsets >> j) != 0; j++){
+                if((primetuplets::PATTERNS[k].offsets >> j) & 1){ all = all && binary_search(primes.begin(), primes.end(), p + 2 * j); }
+            }
+            counts[k] += all;
+        }
+    }
+    return counts;
+}
+
+void addTupletModes(vector<sieveverify::VerifyMode> &modes){
+
+    // Constellation counts, with segments of 64 and 4096 bytes so that many constellations straddle a boundary.
+
+    for(segsieve::SieveConfig config : {segsieve::SieveConfig{MAX_THREADS, 64, 30}, segsieve::SieveConfig{MAX_THREADS, 4096, 210}}){
+        sieveverify::VerifyMode mode;
+        mode.name = "tuplets/" + to_string(config.segmentBytes) + " B";
+        mode.maxLimit = MAX_PRIME;
+        mode.supportsRanges = true;
+        mode.statistics = [config] (uint64_t low, uint64_t high) {
+            sieveanalysis::AnalysisOptions analysis;
+            analysis.tuplets = true;
+            primetuplets::TupletCounts tuplets = sieveanalysis::analyzeRange(THREAD_POOL, low, high, config, analysis).tuplets;
+            return vector<uint64_t>(tuplets.counts, tuplets.counts + primetuplets::PATTERN_COUNT);
+        };
+        mode.statisticsOf = [] (const vector<uint64_t> &primes, uint64_t, uint64_t) {
+            return tupletCounts(primes);
+        };
+        modes.push_back(mode);
+    }
+}
+
+void addGapModes(vector<sieveverify::VerifyMode> &modes){
+
+    // Gap histogram and record gaps, flattened as first, last, the histogram, then (prime, length) per record.
+
+    for(segsieve::SieveConfig config : {segsieve::SieveConfig{MAX_THREADS, 64, 30}, segsieve::SieveConfig{MAX_THREADS, 4096, 210}}){
+        auto flatten = [] (const primegaps::GapStats &gaps) {
+            vector<uint64_t> values = {gaps.first, gaps.last, gaps.histogram.size()};
+            values.insert(values.end(), gaps.histogram.begin(), gaps.histogram.end());
+            for(const primegaps::Gap &gap : gaps.records){
+                values.push_back(gap.prime);
+                values.push_back(gap.length);
+            }
+            return values;
+        };
+        sieveverify::VerifyMode mode;
+        mode.name = "gaps/" + to_string(config.segmentBytes) + " B";
+        mode.maxLimit = MAX_PRIME;
+        mode.supportsRanges = true;
+        mode.statistics = [config, flatten] (uint64_t low, uint64_t high) {
+            sieveanalysis::AnalysisOptions analysis;
+            analysis.gaps = true;
+            return flatten(sieveanalysis::analyzeRange(THREAD_POOL, low, high, config, analysis).gaps);
+        };
+        mode.statisticsOf = [flatten] (const vector<uint64_t> &primes, uint64_t, uint64_t) {
+            primegaps::GapStats gaps;
+            for(uint64_t prime : primes){
+                if(gaps.first == 0){ gaps.first = prime; }
+                else { primegaps::addGap(gaps, gaps.last, prime - gaps.last); }
+                gaps.last = prime;
+            }
+            return flatten(gaps);
+        };
+        modes.push_back(mode);
+    }
+}
+
+void addResidueModes(vector<sieveverify::VerifyMode> &modes){
+
+    // pi(x; q, a) and the sums per class, for a modulus below the word size and one well above it.
+
+    for(uint64_t modulus : {30, 2310}){
+        segsieve::SieveConfig config{MAX_THREADS, modulus == 30 ? 64U : 4096U, 30};
+        sieveverify::VerifyMode mode;
+        mode.name = "residues mod " + to_string(modulus);
+        mode.maxLimit = MAX_PRIME;
+        mode.supportsRanges = true;
+        mode.statistics = [config, modulus] (uint64_t low, uint64_t high) {
+            sieveanalysis::AnalysisOptions analysis;
+            analysis.residueModulus = modulus;
+            primeresidues::ResidueTable table = sieveanalysis::analyzeRange(THREAD_POOL, low, high, config, analysis).residues;
+            vector<uint64_t> values = table.counts;
+            for(segsieve::PrimeSum sum : table.sums){ values.push_back((uint64_t)sum); }
+            return values;
+        };
+        mode.statisticsOf = [modulus] (const vector<uint64_t> &primes, uint64_t, uint64_t) {
+            vector<uint64_t> values(2 * modulus);
+            for(uint64_t prime : primes){
+                values[prime % modulus]++;
+                values[modulus + prime % modulus] += prime;
+            }
+            return values;
+        };
+        modes.push_back(mode);
+    }
+}
+
+void addIncrementalModes(vector<sieveverify::VerifyMode> &modes){
+
+    // One incremental sieve extended in three steps, so that the stored report is merged across two old limits;
+    // the tuplets and gaps must come out as if the whole range had been sieved at once.
+
+    segsieve::SieveConfig config{MAX_THREADS, 64, 30};
+    sieveanalysis::AnalysisOptions analysis;
+    analysis.tuplets = true;
+    analysis.gaps = true;
+    auto extend = [config, analysis] (uint64_t limit) {
+        incrementalsieve::IncrementalSieve sieve(config, analysis);
+        for(uint64_t step : {limit / 7, limit / 2 + 1, limit}){ sieve.extendTo(THREAD_POOL, step); }
+        return sieve.report();
+    };
+    sieveverify::VerifyMode mode;
+    mode.name = "incremental/3 extensions";
+    mode.maxLimit = MAX_PRIME;
+    mode.countPrimes = [extend] (uint64_t limit) {
+        segsieve::PrimeSummary summary = extend(limit).summary;
+        return sieveverify::PrimeTotals{summary.count, (uint64_t)summary.sum};
+    };
+    mode.statistics = [extend] (uint64_t, uint64_t high) {
+        sieveanalysis::RangeReport report = extend(high);
+        vector<uint64_t> values(report.tuplets.counts, report.tuplets.counts + primetuplets::PATTERN_COUNT);
+        values.insert(values.end(), report.gaps.histogram.begin(), report.gaps.histogram.end());
+        return values;
+    };
+    mode.statisticsOf = [] (const vector<uint64_t> &primes, uint64_t, uint64_t) {
+        vector<uint64_t> values = tupletCounts(primes);
+        primegaps::GapStats gaps;
+        for(size_t i = 1; i < primes.size(); i++){ primegaps::addGap(gaps, primes[i - 1], primes[i] - primes[i - 1]); }
+        values.insert(values.end(), gaps.histogram.begin(), gaps.histogram.end());
+        return values;
+    };
+    modes.push_back(mode);
+}
+
+void addPlannerModes(vector<sieveverify::VerifyMode> &modes){
+
+    // The range planner: five overlapping, nested and adjacent queries over [low, high] answered together; each
+    // query's count, sum and largest prime must match its own slice of the reference primes.
+
+    auto queriesOf = [] (uint64_t low, uint64_t high) {
+        uint64_t width = high - low;
+        return vector<rangeplanner::RangeQuery>{{low, low + width / 2}, {low + width / 2 + 1, high}, {low + width / 3, high - width / 5},
+                                                {low, high}, {low + width / 4, low + width / 4 + width / 9}};
+    };
+    sieveverify::VerifyMode mode;
+    mode.name = "planner/5 queries";
+    mode.maxLimit = MAX_PRIME;
+    mode.supportsRanges = true;
+    mode.statistics = [queriesOf] (uint64_t low, uint64_t high) {
+        vector<uint64_t> values;
+        for(const segsieve::PrimeSummary &answer : rangeplanner::answerQueries(THREAD_POOL, queriesOf(low, high), segsieve::SieveConfig{MAX_THREADS, 64, 30})){
+            values.insert(values.end(), {answer.count, (uint64_t)answer.sum, answer.largest.empty() ? 0 : answer.largest.back()});
+        }
+        return values;
+    };
+    mode.statisticsOf = [queriesOf] (const vector<uint64_t> &primes, uint64_t low, uint64_t high) {
+        vector<uint64_t> values;
+        for(const rangeplanner::RangeQuery &query : queriesOf(low, high)){
+            uint64_t count = 0, sum = 0, largest = 0;
+            for(uint64_t prime : primes){
+                if(prime < query.low || prime > query.high){ continue; }
+                count++;
+                sum += prime;
+                largest = prime;
+            }
+            values.insert(values.end(), {count, sum, largest});
+        }
+        return values;
+    };
+    modes.push_back(mode);
+}
+
+void addServerModes(vector<sieveverify::VerifyMode> &modes){
+
+    // The server's request handler in process: is-prime and counts inside its index of [0, 3000000] and past it, the
+    // counts in one batch so that their tails past the index are planned together.
+
+    auto server = make_shared<sieveserver::Server>(THREAD_POOL, segsieve::SieveConfig{MAX_THREADS, 4096, 30});
+    sieveverify::VerifyMode mode;
+    mode.name = "server/index and fallback";
+    mode.maxLimit = 10000000;
+    mode.supportsRanges = true;
+    mode.listPrimes = [server] (uint64_t low, uint64_t high) {
+        if(server->primeIndex().empty()){ server->warmUp(3000000); }
+        vector<uint64_t> primes;
+        for(uint64_t n = low; n <= high; n++){
+            if(server->handle({sieveserver::OP_IS_PRIME, 0, n, 0}).values[0] == 1){ primes.push_back(n); }
+        }
+        return primes;
+    };
+    mode.countPrimes = [server] (uint64_t limit) {
+        if(server->primeIndex().empty()){ server->warmUp(3000000); }
+        sieveserver::Request requests[3] = {{sieveserver::OP_COUNT, 0, 0, limit / 3}, {sieveserver::OP_IS_PRIME, 0, limit, 0},
+                                            {sieveserver::OP_COUNT, 0, limit / 3 + 1, limit}};
+        sieveserver::Response responses[3];
+        server->handleBatch(requests, responses, 3);
+        return sieveverify::PrimeTotals{responses[0].values[0] + responses[2].values[0], responses[0].values[1] + responses[2].values[1]};
+    };
+    modes.push_back(mode);
+}
+
+void addFactorModes(vector<sieveverify::VerifyMode> &modes){
+
+    // The factorisation sieve: the primes are the numbers that factor as themselves, and every factorisation has
+    // to multiply back to its number with increasing primes.
+
+    sieveverify::VerifyMode mode;
+    mode.name = "factor sieve";
+    mode.maxLimit = 10000000;
+    mode.supportsRanges = true;
+    mode.listPrimes = [] (uint64_t low, uint64_t high) {
+        vector<vector<uint64_t>> segments = factorsieve::factorRange(THREAD_POOL, low, high, [] (const factorsieve::FactorSegment &segment) {
+            vector<uint64_t> primes;
+            segment.forEach([&] (uint64_t n, const factorsieve::Factor* factors, size_t count) {
+                unsigned __int128 product = 1;
+                for(size_t i = 0; i < count; i++){
+                    for(unsigned e = 0; e < factors[i].exponent; e++){ product *= factors[i].prime; }
+                    if(i > 0 && factors[i].prime <= factors[i - 1].prime){ product = 0; }
+                }
+                if(n > 0 && product != n){ primes.push_back(0); }  // shows up as a mismatch against the reference
+                if(segment.isPrime(n) != (count == 1 && factors[0].prime == n)){ primes.push_back(0); }
+                if(segment.isPrime(n)){ primes.push_back(n); }
+            });
+            return primes;
+        });
+        vector<uint64_t> primes;
+        for(const vector<uint64_t> &segment : segments){ primes.insert(primes.end(), segment.begin(), segment.end()); }
+        return primes;
+    };
+    modes.push_back(mode);
+}
+
+void addEngineModes(vector<sieveverify::VerifyMode> &modes){
+
+    // Every engine behind the common interface, with small segments so that each range crosses many boundaries.
+
+    for(const char* name : sieveengines::ENGINE_NAMES){
+        segsieve::SieveConfig config{MAX_THREADS, 64, 30};
+        auto engine = shared_ptr<sieveengines::SegmentEngine>(sieveengines::makeEngine(name, config));
+        sieveverify::VerifyMode mode;
+        mode.name = string("engine/") + name;
+        mode.maxLimit = MAX_PRIME;
+        mode.supportsRanges = true;
+        mode.listPrimes = [engine, config] (uint64_t low, uint64_t high) {
+            engine->prepare(high);
+            return sieveengines::listWith(THREAD_POOL, *engine, low, high, config);
+        };
+        mode.countPrimes = [engine, config] (uint64_t limit) {
+            engine->prepare(limit);
+            segsieve::PrimeSummary summary = sieveengines::summarizeWith(THREAD_POOL, *engine, 0, limit, config);
+            return sieveverify::PrimeTotals{summary.count, (uint64_t)summary.sum};
+        };
+        modes.push_back(mode);
     }
+}
+
+void addBudgetModes(vector<sieveverify::VerifyMode> &modes){
+
+    // The memory-budgeted run with two output buffers, so that the writer keeps recycling them: the primes it writes
+    // and the summary it returns must both match.
+
+    segsieve::SieveConfig config{MAX_THREADS, 64, 30};
+    sieveverify::VerifyMode mode;
+    mode.name = "budget/2 output buffers";
+    mode.maxLimit = MAX_PRIME;
+    mode.listPrimes = [config] (uint64_t low, uint64_t high) {
+        memorybudget::BudgetPlan plan;
+        plan.buffers = 2;
+        plan.bufferBytes = 4096;
+        ostringstream text;
+        memorybudget::sieveWithinBudget(THREAD_POOL, high, config, plan, &text);
+        istringstream lines(text.str());
+        vector<uint64_t> primes;
+        for(uint64_t prime; lines >> prime;){
+            if(prime >= low){ primes.push_back(prime); }
+        }
+        return primes;
+    };
+    mode.countPrimes = [config] (uint64_t limit) {
+        memorybudget::BudgetPlan plan;
+        plan.buffers = 2;
+        segsieve::PrimeSummary summary = memorybudget::sieveWithinBudget(THREAD_POOL, limit, config, plan, nullptr).summary;
+        return sieveverify::PrimeTotals{summary.count, (uint64_t)summary.sum};
+    };
+    modes.push_back(mode);
+}
+
+void addDeadlineModes(vector<sieveverify::VerifyMode> &modes){
+
+    // The cancellable summary with a deadline an hour away must cover the whole range, and with a token cancelled
+    // before it starts must sieve nothing.
+
+    segsieve::SieveConfig config{MAX_THREADS, 64, 30};
+    sieveverify::VerifyMode mode;
+    mode.name = "segmented/with deadline";
+    mode.maxLimit = MAX_PRIME;
+    mode.supportsRanges = true;
+    mode.countPrimes = [config] (uint64_t limit) {
+        segsieve::PartialSummary partial = segsieve::summarizeUntil(THREAD_POOL, 0, limit, config, BS::cancel_token(chrono::hours(1)));
+        return partial.complete && partial.reached == limit ? sieveverify::PrimeTotals{partial.summary.count, (uint64_t)partial.summary.sum}
+                                                            : sieveverify::PrimeTotals{};
+    };
+    mode.statistics = [config] (uint64_t low, uint64_t high) {
+        BS::cancel_token cancelled;
+        cancelled.cancel();
+        segsieve::PartialSummary partial = segsieve::summarizeUntil(THREAD_POOL, low, high, config, cancelled);
+        return vector<uint64_t>{partial.summary.count, partial.complete};
+    };
+    mode.statisticsOf = [] (const vector<uint64_t>&, uint64_t, uint64_t) { return vector<uint64_t>{0, 0}; };
+    modes.push_back(mode);
+}
+
+void addCheckpointModes(vector<sieveverify::VerifyMode> &modes){
+
+    // A run resumed from a checkpoint taken halfway, at the last batch boundary before limit / 2.
+
+    segsieve::SieveConfig config{MAX_THREADS, 64, 30};
+    sieveverify::VerifyMode mode;
+    mode.name = "segmented/resumed from checkpoint";
+    mode.maxLimit = 10000000;
+    mode.countPrimes = [config] (uint64_t limit) {
+        const string path = "sieve_verify_checkpoint.txt";
+        uint64_t batchSpan = segsieve::segmentSpan(config) * sievecheckpoint::BATCH_SEGMENTS;
+        sievecheckpoint::Checkpoint halfway{0, limit, config.segmentBytes, limit / 2 / batchSpan * batchSpan, {}};
+        if(halfway.next > 0){ halfway.summary = segsieve::summarizeRange(THREAD_POOL, 0, halfway.next - 1, config); }
+        sievecheckpoint::saveCheckpoint(path, halfway);
+        ostringstream log;
+        segsieve::PrimeSummary summary = sievecheckpoint::summarizeRange(THREAD_POOL, 0, limit, config, path, 0, true, log);
+        remove(path.c_str());
+        return sieveverify::PrimeTotals{summary.count, (uint64_t)summary.sum};
+    };
+    modes.push_back(mode);
+}
+
+vector<sieveverify::VerifyMode> verifyModes(){
+
+    // Every sieve mode the program offers, wrapped so the verification suite can compare it against the reference.
+
+    vector<sieveverify::VerifyMode> modes;
+    addWheelModes(modes);
+    addSegmentedModes(modes);
+    addSharedModes(modes);
+    addShardModes(modes);
+    addCountModes(modes);
+    addTailModes(modes);
+    addPrimalityModes(modes);
+    addTupletModes(modes);
+    addGapModes(modes);
+    addResidueModes(modes);
+    addIncrementalModes(modes);
+    addPlannerModes(modes);
+    addServerModes(modes);
+    addFactorModes(modes);
+    addEngineModes(modes);
+    addBudgetModes(modes);
+    addDeadlineModes(modes);
+    addCheckpointModes(modes);
+    return modes;
+}
+
+void writeReport(long long time, uint64_t count, segsieve::PrimeSum sum, const vector<uint64_t> &topTen, const vector<string> &statistics = {}){
     ofstream file("primes.txt");
     file << "Run time: " << time << " ms" << endl;
     file << "Total primes: " << count << endl;
-    file << "Sum of primes: " << sum << endl;
+    file << "Sum of primes: " << segsieve::sumToString(sum) << endl;
     file << "Top ten maximum primes: " << endl;
-
-    for(auto it = primeVector[MAX_THREADS-1].end() - 11; it != primeVector[MAX_THREADS-1].end() - 1; ++it){  // Skip checking 2, 3, and 5
-        file << *it << " ";
+    for(uint64_t prime : topTen){
+        file << prime << " ";
+    }
+    for(const string &line : statistics){
+        file << endl << line;
     }
     file.close();
+}
+
+int tailQuery(const Options &options){
+
+    // --tail, --prev-prime and --next-prime: a few windows around one number instead of a whole sieve.
+
+    auto begin = chrono::steady_clock::now();
+    vector<uint64_t> primes;
+    if(options.tail > 0){
+        primes = primetail::largestPrimes(options.limit, options.tail);
+    } else {
+        uint64_t prime = options.neighbour == "prev" ? primetail::prevPrime(options.neighbourOf) : primetail::nextPrime(options.neighbourOf);
+        if(prime != 0){ primes.push_back(prime); }
+    }
+    auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+    for(uint64_t prime : primes){ cout << prime << endl; }
+    cerr << primes.size() << " primes in " << elapsed << " us" << endl;
+    return primes.empty() ? 1 : 0;
+}
+
+int primalityQuery(const Options &options){
+
+    // --is-prime prints a verdict per number; --bench-primality reports the batch throughput on random odd numbers.
+
+    vector<uint64_t> numbers = options.primalityOf;
+    if(options.primalityBench > 0){
+        mt19937_64 random(20240918);
+        numbers.resize(options.primalityBench);
+        for(uint64_t &n : numbers){ n = random() | 1; }
+    }
+    auto begin = chrono::steady_clock::now();
+    vector<char> prime = primality::isPrimeBatch(THREAD_POOL, numbers);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    if(options.primalityBench > 0){
+        size_t primes = count(prime.begin(), prime.end(), 1);
+        cout << numbers.size() << " numbers, " << primes << " prime, in " << seconds * 1000 << " ms: "
+             << numbers.size() / seconds / 1e6 << " M checks/s on " << THREAD_POOL.get_thread_count() << " threads" << endl;
+        return 0;
+    }
+    for(size_t i = 0; i < numbers.size(); i++){ cout << numbers[i] << (prime[i] ? " is prime" : " is composite") << endl; }
+    return 0;
+}
+
+int factorQuery(const Options &options){
+
+    // --factor prints "n = p^e * ..." for every n of the range, in order; --factor-stats only counts. Either way only
+    // a few segments per thread are in flight at a time, so memory does not grow with the range.
+
+    if(options.factorHigh < options.factorLow || options.factorHigh > factorsieve::MAX_HIGH){
+        cerr << "--factor needs LOW <= HIGH <= " << factorsieve::MAX_HIGH << endl;
+        return 2;
+    }
+    struct FactorStats {
+        uint64_t numbers = 0;
+        uint64_t primes = 0;
+        uint64_t primeFactors = 0;   // with multiplicity
+        uint64_t mostFactorsOf = 0;  // the first number with the most prime factors
+        uint64_t mostFactors = 0;
+        string text;                 // the segment's lines for --factor
+    };
+    const bool list = options.factorMode == "list";
+    auto consume = [list] (const factorsieve::FactorSegment &segment) {
+        FactorStats stats;
+        ostringstream text;
+        segment.forEach([&] (uint64_t n, const factorsieve::Factor* factors, size_t count) {
+            uint64_t primeFactors = 0;
+            for(size_t i = 0; i < count; i++){ primeFactors += factors[i].exponent; }
+            stats.numbers++;
+            stats.primes += segment.isPrime(n);
+            stats.primeFactors += primeFactors;
+            if(primeFactors > stats.mostFactors){
+                stats.mostFactors = primeFactors;
+                stats.mostFactorsOf = n;
+            }
+            if(!list){ return; }
+            text << n << " =";
+            if(count == 0){ text << " " << n; }
+            for(size_t i = 0; i < count; i++){
+                text << (i > 0 ? " * " : " ") << factors[i].prime;
+                if(factors[i].exponent > 1){ text << "^" << factors[i].exponent; }
+            }
+            text << "\n";
+        });
+        stats.text = text.str();
+        return stats;
+    };
+
+    auto begin = chrono::steady_clock::now();
+    FactorStats total;
+    factorsieve::forEachSegment(THREAD_POOL, options.factorLow, options.factorHigh, consume, [&] (const FactorStats &segment) {
+        total.numbers += segment.numbers;
+        total.primes += segment.primes;
+        total.primeFactors += segment.primeFactors;
+        if(segment.mostFactors > total.mostFactors){
+            total.mostFactors = segment.mostFactors;
+            total.mostFactorsOf = segment.mostFactorsOf;
+        }
+        cout << segment.text;
+    });
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+    (list ? cerr : cout) << "factorised " << total.numbers << " numbers in " << elapsed << " ms: " << total.primes << " primes, "
+                         << total.primeFactors << " prime factors with multiplicity, most (" << total.mostFactors << ") in "
+                         << total.mostFactorsOf << endl;
     return 0;
-}
\ No newline at end of file
+}
+
+int extendIncrementally(const Options &options){
+
+    // --limits: one incremental sieve extended to each limit in turn, timing each extension on its own.
+
+    incrementalsieve::IncrementalSieve sieve(options.config, options.analysis);
+    sievearena::arena().prepare(segsieve::arenaBytes(options.config), THREAD_POOL);
+    long long total = 0;
+    for(uint64_t limit : options.limits){
+        uint64_t from = sieve.empty() ? 0 : sieve.limit();
+        auto begin = chrono::steady_clock::now();
+        const sieveanalysis::RangeReport &report = sieve.extendTo(THREAD_POOL, limit);
+        auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+        total += elapsed;
+        cout << "extended " << from << " -> " << sieve.limit() << " in " << elapsed << " ms: " << report.summary.count << " primes, sum "
+             << segsieve::sumToString(report.summary.sum) << " (base primes up to " << sieve.basePrimeLimit() << ")" << endl;
+    }
+    const sieveanalysis::RangeReport &report = sieve.report();
+    writeReport(total, report.summary.count, report.summary.sum, report.summary.largest, sieveanalysis::reportLines(report, options.analysis));
+    return 0;
+}
+
+int answerRanges(const Options &options){
+
+    // --ranges: every range's count, sum and largest prime, from one sieve of their union (or one sieve each with
+    // --separately, to compare).
+
+    if(!rangeplanner::checkQueries(options.ranges, cerr)){ return 2; }
+    sievearena::arena().prepare(segsieve::arenaBytes(options.config), THREAD_POOL);
+    rangeplanner::QueryPlan plan = rangeplanner::planQueries(options.ranges, options.config);
+    auto begin = chrono::steady_clock::now();
+    vector<segsieve::PrimeSummary> answers;
+    uint64_t sieved = 0;
+    if(options.separately){
+        for(const rangeplanner::RangeQuery &range : options.ranges){
+            rangeplanner::QueryPlan alone = rangeplanner::planQueries({range}, options.config);
+            answers.push_back(rangeplanner::answerQueries(THREAD_POOL, {range}, options.config, alone)[0]);
+            sieved += alone.scheduled;
+        }
+    } else {
+        answers = rangeplanner::answerQueries(THREAD_POOL, options.ranges, options.config, plan);
+        sieved = plan.scheduled;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    for(size_t q = 0; q < options.ranges.size(); q++){
+        cout << "[" << options.ranges[q].low << ", " << options.ranges[q].high << "]: " << answers[q].count << " primes, sum "
+             << segsieve::sumToString(answers[q].sum);
+        if(!answers[q].largest.empty()){ cout << ", largest " << answers[q].largest.back(); }
+        cout << endl;
+    }
+    cout << options.ranges.size() << " ranges of " << plan.requested << " numbers in " << seconds * 1000 << " ms ("
+         << plan.requested / seconds / 1e6 << " M numbers/s requested), sieved " << sieved << " numbers"
+         << (options.separately ? " one range at a time" : " in " + to_string(plan.merged.size()) + " merged intervals") << endl;
+    return 0;
+}
+
+int runWithinBudget(const Options &options){
+
+    // --memory-budget: the segmented engine with a bounded number of segments and output buffers in flight, optionally
+    // writing every prime to a file, and the peak resident set reported against the budget.
+
+    sievearena::arena().prepare(segsieve::arenaBytes(options.config), THREAD_POOL);
+    memorybudget::BudgetPlan plan;
+    if(!memorybudget::planBudget(options.memoryBudgetMb << 20, options.limit, options.config, !options.primesOut.empty(), plan, cerr)){ return 2; }
+    ofstream primes;
+    if(!options.primesOut.empty()){
+        primes.open(options.primesOut, ios::binary);
+        if(!primes){
+            cerr << "could not write " << options.primesOut << endl;
+            return 1;
+        }
+    }
+    auto begin = chrono::steady_clock::now();
+    memorybudget::BudgetResult result = memorybudget::sieveWithinBudget(THREAD_POOL, options.limit, options.config, plan,
+                                                                       options.primesOut.empty() ? nullptr : &primes);
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+    if(primes.is_open() && !primes.flush()){
+        cerr << "could not write " << options.primesOut << endl;
+        return 1;
+    }
+    size_t peak = memorybudget::statusBytes("VmHWM");
+    string line = "Peak RSS: " + to_string(peak >> 20) + " MiB of a " + to_string(options.memoryBudgetMb) + " MiB budget ("
+                + to_string(plan.fixedBytes >> 20) + " MiB fixed, at most " + to_string(result.peakInFlight) + " of "
+                + to_string(plan.buffers) + " output buffers of " + to_string(plan.bufferBytes >> 10) + " KiB in flight)";
+    cout << line << endl;
+    if(result.buffersDropped > 0){ cout << result.buffersDropped << " output buffers were freed because the resident set passed the budget" << endl; }
+    if(result.overBudget){
+        cerr << "stopped after " << result.summary.count << " primes: the resident set passed the budget with a single output buffer left" << endl;
+        return 1;
+    }
+    if(peak > plan.budget){ cout << "the budget was exceeded: the fixed part grew after it was measured" << endl; }
+    writeReport(elapsed, result.summary.count, result.summary.sum, result.summary.largest, {line});
+    return 0;
+}
+
+int benchEngines(const Options &options){
+
+    // --bench-engines: every engine of sieve_engines.hpp at every limit and thread count, with the time, throughput,
+    // the state the engine keeps between segments and the peak resident set of the run.
+
+    vector<unsigned> threadCounts = options.benchThreads;
+    if(threadCounts.empty()){ threadCounts = {1, options.config.threads}; }
+    threadCounts.erase(unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+    bool peaks = memorybudget::resetPeak();
+    cout << "engine        limit         threads  ms        M numbers/s  state MiB  peak RSS MiB  primes" << endl;
+    for(uint64_t limit : options.benchLimits){
+        for(unsigned threads : threadCounts){
+            if(THREAD_POOL.get_thread_count() != threads){ THREAD_POOL.reset(threads); }
+            segsieve::SieveConfig config = options.config;
+            config.threads = threads;
+            sievearena::arena().prepare(segsieve::arenaBytes(config), THREAD_POOL);
+            for(const char* name : sieveengines::ENGINE_NAMES){
+                unique_ptr<sieveengines::SegmentEngine> engine = sieveengines::makeEngine(name, config);
+                if(limit > engine->maxLimit()){ continue; }
+                memorybudget::resetPeak();
+                auto begin = chrono::steady_clock::now();
+                engine->prepare(limit);
+                segsieve::PrimeSummary summary = sieveengines::summarizeWith(THREAD_POOL, *engine, 0, limit, config);
+                double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+                char row[160];
+                snprintf(row, sizeof(row), "%-13s %-13llu %-8u %-9.0f %-12.1f %-10.1f %-13s %llu", name, (unsigned long long)limit, threads,
+                         seconds * 1000, limit / seconds / 1e6, engine->stateBytes() / 1048576.0,
+                         peaks ? to_string(memorybudget::statusBytes("VmHWM") >> 20).c_str() : "-", (unsigned long long)summary.count);
+                cout << row << endl;
+            }
+        }
+    }
+    return 0;
+}
+
+int serve(const Options &options){
+
+    // --serve: build the index and warm everything up once, then answer batches until a shutdown request.
+
+    sieveserver::Server server(THREAD_POOL, options.config);
+    auto begin = chrono::steady_clock::now();
+    server.warmUp(options.limit);
+    cout << "index of [0, " << options.limit << "] ready in "
+         << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count() << " ms" << endl;
+    if(!server.run(options.servePath, cout)){ return 1; }
+    server.latencies().print(cout);
+    return 0;
+}
+
+int runShard(const Options &options){
+
+    // One shard of a run that is split across processes: sieve it with the segmented engine and write the partial
+    // result (and optionally the bitmap) for --merge to combine.
+
+    if(options.shards > segsieve::segmentCount(0, options.limit, options.config)){
+        cerr << "cannot split " << options.limit << " into " << options.shards << " shards of whole segments" << endl;
+        return 2;
+    }
+    string path = !options.partialPath.empty() ? options.partialPath
+                : "shard-" + to_string(options.shard) + "-of-" + to_string(options.shards) + ".part";
+    ofstream bitmap;
+    if(options.writeBitmap){ bitmap.open(path + ".bits", ios::binary); }
+    sievearena::arena().prepare(segsieve::arenaBytes(options.config), THREAD_POOL);
+
+    auto begin = chrono::steady_clock::now();
+    sieveshard::PartialResult result = sieveshard::sieveShard(THREAD_POOL, options.limit, options.shard, options.shards, options.config,
+                                                              options.writeBitmap ? &bitmap : nullptr);
+    result.milliseconds = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+    if(options.writeBitmap){ result.bitmapPath = path + ".bits"; }
+
+    ofstream file(path);
+    sieveshard::writePartial(file, result);
+    if(!file || (options.writeBitmap && !bitmap)){
+        cerr << "could not write " << path << (options.writeBitmap ? " or its bitmap" : "") << endl;
+        return 1;
+    }
+    cout << "shard " << options.shard << "/" << options.shards << ": [" << result.low << ", " << result.high << "], "
+         << result.count << " primes in " << result.milliseconds << " ms -> " << path << endl;
+    return 0;
+}
+
+int mergeShards(const Options &options){
+
+    // Combines the partial results of every shard of a run into the usual primes.txt report.
+
+    vector<sieveshard::PartialResult> parts;
+    for(const string &path : options.mergeFiles){
+        ifstream file(path);
+        sieveshard::PartialResult part;
+        if(!file || !sieveshard::readPartial(file, part)){
+            cerr << "could not read partial result " << path << endl;
+            return 1;
+        }
+        parts.push_back(part);
+    }
+    sieveshard::PartialResult merged;
+    if(!sieveshard::mergePartials(parts, merged, cerr)){ return 1; }
+    if(!options.bitmapOut.empty()){
+        ofstream bitmap(options.bitmapOut, ios::binary);
+        if(!sieveshard::concatenateBitmaps(parts, bitmap, cerr)){ return 1; }
+    }
+    writeReport(merged.milliseconds, merged.count, merged.sum, merged.largest);
+    cout << "merged " << parts.size() << " shards up to " << merged.limit << ": " << merged.count << " primes" << endl;
+    return 0;
+}
+
+int main(int argc, char** argv){
+    Options options = parseOptions(argc, argv);
+    if(THREAD_POOL.get_thread_count() != options.config.threads){ THREAD_POOL.reset(options.config.threads); }
+
+    if(options.verify){ return sieveverify::runVerification(verifyModes(), cout) ? 0 : 1; }
+    if(options.autotune){
+        autotune::CacheSizes caches = autotune::probeCacheSizes();
+        uint64_t calibrationLimit = options.limit == (uint64_t)MAX_PRIME ? 20000000 : options.limit;
+        segsieve::SieveConfig tuned = autotune::tune(THREAD_POOL, caches, calibrationLimit, cout);
+        if(!autotune::saveProfile(autotune::PROFILE_FILE, tuned, caches)){
+            cerr << "could not write " << autotune::PROFILE_FILE << endl;
+            return 1;
+        }
+        cout << "saved to " << autotune::PROFILE_FILE << endl;
+        return 0;
+    }
+
+    if(!options.mergeFiles.empty()){ return mergeShards(options); }
+    if(options.tail > 0 || !options.neighbour.empty()){ return tailQuery(options); }
+    if(!options.primalityOf.empty() || options.primalityBench > 0){ return primalityQuery(options); }
+    if(!options.factorMode.empty()){ return factorQuery(options); }
+    if(!options.limits.empty()){ return extendIncrementally(options); }
+    if(!options.ranges.empty()){ return answerRanges(options); }
+    if(!options.primesOut.empty() && options.memoryBudgetMb == 0){
+        cerr << "--primes-out writes the primes of a --memory-budget run; add --memory-budget MB" << endl;
+        return 2;
+    }
+    if(options.memoryBudgetMb > 0){ return runWithinBudget(options); }
+    if(!options.benchLimits.empty()){ return benchEngines(options); }
+    if(!options.servePath.empty()){ return serve(options); }
+    if(!options.load.path.empty()){
+        options.load.rangeLimit = options.limit;
+        return sieveload::runLoad(options.load, cout) ? 0 : 1;
+    }
+    if(!options.stopPath.empty()){
+        sieveserver::Response response;
+        return sieveload::sendOne(options.stopPath, {sieveserver::OP_SHUTDOWN, 0, 0, 0}, response, cerr) ? 0 : 1;
+    }
+    if(options.shards > 0){ return runShard(options); }
+
+    if(options.engine == "wheel" && (options.limit < 10 || options.limit > 2000000000)){
+        cerr << "the wheel engine supports limits from 10 to 2000000000; use --engine segmented" << endl;
+        return 2;
+    }
+    unique_ptr<sieveengines::SegmentEngine> engine = sieveengines::makeEngine(options.engine, options.config);
+    if(engine != nullptr && options.limit > engine->maxLimit()){
+        cerr << "the " << options.engine << " engine supports limits up to " << engine->maxLimit() << endl;
+        return 2;
+    }
+    if(!options.checkpointPath.empty() && options.engine != "segmented"){
+        cerr << "checkpoints are only written by the segmented engine; add --engine segmented" << endl;
+        return 2;
+    }
+    if(options.analysis.any() && (options.engine != "segmented" || !options.checkpointPath.empty())){
+        cerr << "--tuplets, --gaps and --residues are gathered by the segmented engine without checkpoints; add --engine segmented" << endl;
+        return 2;
+    }
+    if(options.deadlineMs > 0 && (options.engine != "segmented" || !options.checkpointPath.empty() || options.analysis.any())){
+        cerr << "--deadline stops the segmented engine between segments, without checkpoints or statistics; add --engine segmented" << endl;
+        return 2;
+    }
+    if(options.analysis.residueModulus > primeresidues::MAX_MODULUS){
+        cerr << "--residues takes a modulus up to " << primeresidues::MAX_MODULUS << endl;
+        return 2;
+    }
+
+    SIEVE_PROFILE_ATTACH_POOL(THREAD_POOL);
+    uint64_t count = 0;
+    segsieve::PrimeSum sum = 0;  // exact beyond 2^64
+    vector<uint64_t> topTen;
+    vector<string> statistics;
+    long long time = 0;
+    for(int run = 0; run < options.repeat; run++){
+
+        // The arena is mapped and pre-faulted before the clock starts; later runs reuse the same pages.
+
+        size_t arenaBytes = options.engine != "wheel" ? segsieve::arenaBytes(options.config)
+                          : wheelArenaBytes(makeChunkLayout((int)options.limit, options.config.threads));
+        sievearena::arena().prepare(arenaBytes, THREAD_POOL);
+        count = 0;
+        sum = 0;
+        topTen.clear();
+
+        auto begin = chrono::steady_clock::now(); // Starting time
+        if(options.engine == "lucy"){
+            primecount::Totals totals = primecount::countPrimes(THREAD_POOL, options.limit);
+            count = totals.count;
+            sum = totals.sum;
+            topTen = primetail::largestPrimes(options.limit, segsieve::TOP_PRIMES);
+        } else if(engine != nullptr){
+            engine->prepare(options.limit);
+            segsieve::PrimeSummary summary = sieveengines::summarizeWith(THREAD_POOL, *engine, 0, options.limit, options.config);
+            count = summary.count;
+            sum = summary.sum;
+            topTen = summary.largest;
+        } else if(options.engine == "segmented" || options.engine == "shared"){
+            segsieve::PrimeSummary summary;
+            if(options.engine == "shared"){
+                sharedbitmap::SharedBitmap bitmap;
+                bitmap.build(THREAD_POOL, options.limit, options.config);
+                summary = bitmap.summarize(THREAD_POOL);
+            } else if(!options.checkpointPath.empty()){
+                summary = sievecheckpoint::summarizeRange(THREAD_POOL, 0, options.limit, options.config, options.checkpointPath,
+                                                          options.checkpointSeconds, options.resume, cout);
+            } else if(options.analysis.any()){
+                sieveanalysis::RangeReport report = sieveanalysis::analyzeRange(THREAD_POOL, 0, options.limit, options.config, options.analysis);
+                summary = report.summary;
+                statistics = sieveanalysis::reportLines(report, options.analysis);
+            } else if(options.deadlineMs > 0){
+                segsieve::PartialSummary partial = segsieve::summarizeUntil(THREAD_POOL, 0, options.limit, options.config,
+                                                                            BS::cancel_token(chrono::milliseconds(options.deadlineMs)));
+                summary = partial.summary;
+                statistics.clear();
+                if(!partial.complete){
+                    statistics.push_back("Deadline of " + to_string(options.deadlineMs) + " ms passed: the totals cover [0, "
+                                         + to_string(partial.reached) + "] only");
+                    cout << statistics.back() << endl;
+                }
+            } else {
+                summary = segsieve::summarizeRange(THREAD_POOL, 0, options.limit, options.config);
+            }
+            count = summary.count;
+            sum = summary.sum;
+            topTen = summary.largest;
+        } else {
+            vector<PrimeList> primeVector = options.barriers ? wheelSieve((int)options.limit, options.config.threads)
+                                                             : wheelSieveGraph((int)options.limit, options.config.threads);
+            segsieve::PrimeSummary summary = THREAD_POOL.submit_reduce<size_t>(0, primeVector.size(), [&] (size_t i) {
+                return chunkSummary(primeVector[i]);
+            }, segsieve::mergeSummaries).get();
+            count = summary.count;
+            sum = summary.sum;
+            topTen = summary.largest;
+        }
+        auto runTime = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count(); // Ending time
+        time = run == 0 ? runTime : min(time, (long long)runTime);
+        if(options.repeat > 1){
+            cout << "run " << run + 1 << ": " << runTime << " ms (arena " << sievearena::arena().used() / 1024 << " of "
+                 << sievearena::arena().capacity() / 1024 << " KiB, " << sievearena::arena().backing() << ")" << endl;
+        }
+    }
+    writeReport(time, count, sum, topTen, statistics);
+
+    if(perfcounters::enabled()){
+        cout << "Run time: " << time << " ms" << endl;
+        perfcounters::report().print(cout);
+    }
+    SIEVE_PROFILE_REPORT(cout, PROFILE_TRACE_FILE);
+    SIEVE_PROFILE_DETACH_POOL();
+    return 0;
+}
@@ -0,0 +1,158 @@
+#ifndef MEMORY_BUDGET_HPP
+#define MEMORY_BUDGET_HPP
+
+/**
+ * Sieving under a memory cap, with every prime written out in order.
+ *
+ * The wheel engine keeps every chunk's bits and every chunk's list of primes until the run ends, so its footprint
+ * grows with the limit. Here the memory is planned up front instead. The budget pays first for what the process
+ * already holds (the binary, the pool's threads and the pre-faulted per-thread segment buffers, read from
+ * /proc/self/status) and for the base primes. What is left is split into output buffers, each big enough for the
+ * text of the primes of one segment. Only that many segments are in flight at once. The calling thread submits
+ * segment k only once it holds a free buffer; otherwise it first waits for the oldest segment, writes its text and
+ * puts the buffer back on the free list. That is the backpressure: the producers on the pool never run further
+ * ahead of the writer than the budget allows. Buffers are cleared rather than freed, so after the first few segments
+ * the run allocates nothing. The peak resident set is read back at the end and reported next to the budget.
+ *
+ * The plan is an estimate, so the writer also reads the resident set (VmRSS; the peak, VmHWM, never comes down again)
+ * every RSS_CHECK_SEGMENTS segments. If it is over the budget, the buffer just written is freed instead of recycled,
+ * which leaves one segment fewer in flight. If it is still over with a single buffer left, the run stops and reports
+ * that it failed.
+ */
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "BS_thread_pool.hpp"
+#include "segmented_sieve.hpp"
+
+namespace memorybudget {
+
+const size_t BUFFERS_PER_THREAD = 4;  // enough to keep every thread busy while the writer catches up
+const size_t RSS_CHECK_SEGMENTS = 16;  // segments written between two reads of VmRSS
+
+// A field of /proc/self/status in bytes, e.g. "VmRSS" or "VmHWM" (the peak); 0 where there is no such file.
+inline size_t statusBytes(const std::string &field){
+    std::ifstream status("/proc/self/status");
+    for(std::string line; std::getline(status, line);){
+        if(line.rfind(field + ":", 0) == 0){ return (size_t)std::stoull(line.substr(field.size() + 1)) * 1024; }  // in kB
+    }
+    return 0;
+}
+
+// Restarts the peak that VmHWM reports from the current resident set (Linux 4.0 and later); false where that fails.
+inline bool resetPeak(){
+    std::ofstream clear("/proc/self/clear_refs");
+    clear << "5";
+    return (bool)clear.flush();
+}
+
+// Upper bound on the primes among span consecutive numbers: pi(x + y) - pi(x) <= 2 y / ln y (Montgomery-Vaughan).
+inline size_t maxPrimesIn(uint64_t span){
+    return (size_t)(2 * (double)span / std::log((double)std::max<uint64_t>(span, 3))) + 8;
+}
+
+struct BudgetPlan {
+    size_t budget = 0;         // bytes; 0 for no cap
+    size_t fixedBytes = 0;     // already resident, plus the base primes
+    size_t buffers = 0;        // output buffers, i.e. segments in flight at most
+    size_t bufferBytes = 0;    // capacity of each
+};
+
+// Splits budget bytes between what the run cannot do without and the output buffers. Call it after the arena has
+// been prepared, so that the per-thread buffers are resident. Returns false with a message on out if not even one
+// buffer fits.
+inline bool planBudget(size_t budget, uint64_t limit, const segsieve::SieveConfig &config, bool writePrimes, BudgetPlan &plan, std::ostream &out){
+    uint64_t root = segsieve::integerSqrt(limit);
+    size_t basePrimeBytes = maxPrimesIn(root + 1) * sizeof(uint32_t) + (size_t)root / 16;
+    plan.budget = budget;
+    plan.fixedBytes = statusBytes("VmRSS") + basePrimeBytes;
+    plan.bufferBytes = writePrimes ? maxPrimesIn(segsieve::segmentSpan(config)) * (std::to_string(limit).size() + 1) : 0;
+    size_t available = budget > plan.fixedBytes ? budget - plan.fixedBytes : 0;
+    plan.buffers = std::min<size_t>(BUFFERS_PER_THREAD * config.threads, plan.bufferBytes == 0 ? SIZE_MAX : available / plan.bufferBytes);
+    if(plan.buffers == 0 || available == 0){
+        out << "a budget of " << budget / (1 << 20) << " MiB leaves no room for a segment's output after " << plan.fixedBytes / (1 << 20)
+            << " MiB resident; lower --segment-bytes or raise the budget" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+struct BudgetResult {
+    segsieve::PrimeSummary summary;   // of the segments written, all of [0, limit] unless overBudget
+    size_t peakInFlight = 0;
+    size_t buffersDropped = 0;        // freed because the resident set passed the budget
+    bool overBudget = false;          // stopped early: over the budget even with one buffer
+};
+
+// Sieves [0, limit] with at most plan.buffers segments in flight, writing every prime on its own line to primes if
+// it is not null. Waits on the pool, so call it from outside the pool's tasks.
+inline BudgetResult sieveWithinBudget(BS::thread_pool &pool, uint64_t limit, const segsieve::SieveConfig &config, const BudgetPlan &plan, std::ostream* primes){
+    struct Slot {
+        std::string text;
+        std::future<segsieve::PrimeSummary> summary;
+    };
+    BudgetResult result;
+    size_t segments = segsieve::segmentCount(0, limit, config);
+    segsieve::BasePrimeTable basePrimes;
+    basePrimes.start(pool, segsieve::integerSqrt(limit), config);
+    std::vector<std::string> freeList(plan.buffers);
+    std::deque<Slot> inFlight;  // oldest first; growing it keeps references to the others valid
+    size_t buffers = plan.buffers, written = 0;
+    try {
+        for(size_t next = 0; (next < segments && !result.overBudget) || !inFlight.empty();){
+            if(next < segments && !result.overBudget && !freeList.empty()){
+                Slot &slot = inFlight.emplace_back();
+                slot.text = std::move(freeList.back());
+                freeList.pop_back();
+                slot.text.reserve(plan.bufferBytes);
+                std::string* text = primes != nullptr ? &slot.text : nullptr;
+                slot.summary = pool.submit_task([&, index = next, text] {
+                    segsieve::SegmentView segment = segsieve::sieveSegmentAt(index, 0, limit, basePrimes, config);
+                    if(text != nullptr){
+                        char digits[24];
+                        segment.forEachPrime([&] (uint64_t prime) {
+                            char* end = std::to_chars(digits, digits + sizeof(digits) - 1, prime).ptr;
+                            *end++ = '\n';
+                            text->append(digits, end);
+                        });
+                    }
+                    return segsieve::summarizeSegment(segment);
+                });
+                next++;
+                result.peakInFlight = std::max(result.peakInFlight, inFlight.size());
+                continue;
+            }
+            Slot &oldest = inFlight.front();
+            result.summary = segsieve::mergeSummaries(result.summary, oldest.summary.get());
+            if(primes != nullptr){ primes->write(oldest.text.data(), (std::streamsize)oldest.text.size()); }
+            oldest.text.clear();
+            bool over = plan.budget > 0 && ++written % RSS_CHECK_SEGMENTS == 0 && statusBytes("VmRSS") > plan.budget;
+            if(over && buffers > 1){
+                buffers--;
+                result.buffersDropped++;
+            } else {
+                result.overBudget = result.overBudget || over;
+                freeList.push_back(std::move(oldest.text));
+            }
+            inFlight.pop_front();
+        }
+    } catch(...){
+        for(Slot &slot : inFlight){  // their tasks still use basePrimes and the buffers
+            if(slot.summary.valid()){ slot.summary.wait(); }
+        }
+        throw;
+    }
+    return result;
+}
+
+} // namespace memorybudget
+
+#endif
@@ -0,0 +1,251 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+/**
+ * Optional hardware performance counters (cycles, instructions, cache misses, branch misses) for the sieve phases.
+ *
+ * Counters are read with perf_event_open on Linux. Each thread opens its own counter group the first time it measures
+ * something, and every measured scope adds its delta to a table keyed by (phase, thread), so the report shows which
+ * worker spent its cycles where. If the kernel refuses the counters (perf_event_paranoid, containers, non-Linux builds)
+ * measuring becomes a no-op and the report says why instead of printing numbers.
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include "BS_thread_pool.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace perfcounters {
+
+enum Event { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, EVENT_COUNT };
+
+const char* const EVENT_NAMES[EVENT_COUNT] = {"cycles", "instructions", "cache-misses", "branch-misses"};
+
+struct Sample {
+    uint64_t values[EVENT_COUNT] = {0, 0, 0, 0};
+    bool present[EVENT_COUNT] = {false, false, false, false};
+
+    Sample& operator+=(const Sample &other){
+        for(int i = 0; i < EVENT_COUNT; i++){
+            values[i] += other.values[i];
+            present[i] = present[i] || other.present[i];
+        }
+        return *this;
+    }
+};
+
+inline Sample difference(const Sample &end, const Sample &start){
+    Sample delta;
+    for(int i = 0; i < EVENT_COUNT; i++){
+        delta.present[i] = end.present[i] && start.present[i];
+        delta.values[i] = delta.present[i] ? end.values[i] - start.values[i] : 0;
+    }
+    return delta;
+}
+
+// Global switch, set from main() when --perf is given. Checked before touching any counter so the default run pays nothing.
+inline bool& enabled(){
+    static bool value = false;
+    return value;
+}
+
+// Reason the counters could not be opened, reported once instead of the table.
+inline std::string& unavailableReason(){
+    static std::string reason;
+    return reason;
+}
+
+inline std::mutex& reasonMutex(){
+    static std::mutex mutex;
+    return mutex;
+}
+
+// One counter group per thread. The leader is the cycle counter; the others are read together with it so the values
+// describe the same interval. Events the CPU or hypervisor does not expose are simply left out of the group.
+class ThreadCounters {
+public:
+    ThreadCounters(){
+#ifdef __linux__
+        const uint64_t configs[EVENT_COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                               PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for(int i = 0; i < EVENT_COUNT; i++){
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = configs[i];
+            attr.disabled = (leader == -1) ? 1 : 0;
+            attr.exclude_kernel = 1;  // user-space only, so perf_event_paranoid <= 2 is enough
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
+            int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+            if(fd == -1){
+                if(leader == -1){
+                    int error = errno;
+                    std::string hint = (error == EACCES || error == EPERM) ? " (try: sudo sysctl kernel.perf_event_paranoid=1)"
+                                     : (error == ENOENT) ? " (no hardware PMU exposed, e.g. inside a VM)" : "";
+                    recordFailure(std::string("perf_event_open(") + EVENT_NAMES[i] + "): " + strerror(error) + hint);
+                }
+                continue;
+            }
+            if(leader == -1){ leader = fd; }
+            fds[i] = fd;
+            ioctl(fd, PERF_EVENT_IOC_ID, &ids[i]);
+        }
+        if(leader != -1){
+            ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#else
+        recordFailure("hardware counters are only supported on Linux");
+#endif
+    }
+
+    ~ThreadCounters(){
+#ifdef __linux__
+        for(int fd : fds){
+            if(fd != -1){ close(fd); }
+        }
+#endif
+    }
+
+    ThreadCounters(const ThreadCounters&) = delete;
+    ThreadCounters& operator=(const ThreadCounters&) = delete;
+
+    bool available() const { return leader != -1; }
+
+    Sample read() const {
+        Sample sample;
+#ifdef __linux__
+        if(leader == -1){ return sample; }
+        // Layout for PERF_FORMAT_GROUP | PERF_FORMAT_ID: nr, then {value, id} per event in the group.
+        uint64_t buffer[1 + 2 * EVENT_COUNT];
+        if(::read(leader, buffer, sizeof(buffer)) <= 0){ return sample; }
+        for(uint64_t n = 0; n < buffer[0]; n++){
+            for(int i = 0; i < EVENT_COUNT; i++){
+                if(fds[i] != -1 && ids[i] == buffer[2 + 2 * n]){
+                    sample.values[i] = buffer[1 + 2 * n];
+                    sample.present[i] = true;
+                }
+            }
+        }
+#endif
+        return sample;
+    }
+
+private:
+    static void recordFailure(const std::string &reason){
+        const std::scoped_lock lock(reasonMutex());
+        if(unavailableReason().empty()){ unavailableReason() = reason; }
+    }
+
+    int leader = -1;
+    int fds[EVENT_COUNT] = {-1, -1, -1, -1};
+    uint64_t ids[EVENT_COUNT] = {0, 0, 0, 0};
+};
+
+inline ThreadCounters& threadCounters(){
+    thread_local ThreadCounters counters;
+    return counters;
+}
+
+// Accumulated deltas, keyed by phase name and thread label ("main", "worker 3", ...).
+class Report {
+public:
+    void add(const std::string &phase, const std::string &thread, const Sample &delta){
+        const std::scoped_lock lock(mutex);
+        totals[{phase, thread}] += delta;
+    }
+
+    void print(std::ostream &out){
+        const std::scoped_lock lock(mutex);
+        out << "== Hardware counters ==" << std::endl;
+        if(totals.empty()){
+            const std::scoped_lock reasonLock(reasonMutex());
+            out << "  unavailable: " << (unavailableReason().empty() ? "no samples recorded" : unavailableReason()) << std::endl;
+            return;
+        }
+        out << "  " << std::left << std::setw(22) << "phase" << std::setw(11) << "thread";
+        for(const char* name : EVENT_NAMES){ out << std::right << std::setw(15) << name; }
+        out << std::setw(8) << "IPC" << std::endl;
+        std::string lastPhase;
+        Sample phaseTotal;
+        for(auto &[key, sample] : totals){
+            if(!lastPhase.empty() && key.first != lastPhase){
+                printRow(out, lastPhase, "all", phaseTotal);
+                phaseTotal = Sample();
+            }
+            printRow(out, key.first, key.second, sample);
+            phaseTotal += sample;
+            lastPhase = key.first;
+        }
+        printRow(out, lastPhase, "all", phaseTotal);
+    }
+
+private:
+    static void printRow(std::ostream &out, const std::string &phase, const std::string &thread, const Sample &sample){
+        out << "  " << std::left << std::setw(22) << phase << std::setw(11) << thread << std::right;
+        for(int i = 0; i < EVENT_COUNT; i++){
+            if(sample.present[i]){ out << std::setw(15) << sample.values[i]; }
+            else { out << std::setw(15) << "n/a"; }
+        }
+        if(sample.present[CYCLES] && sample.present[INSTRUCTIONS] && sample.values[CYCLES] > 0){
+            out << std::setw(8) << std::fixed << std::setprecision(2)
+                << static_cast<double>(sample.values[INSTRUCTIONS]) / static_cast<double>(sample.values[CYCLES]);
+        } else {
+            out << std::setw(8) << "n/a";
+        }
+        out << std::endl;
+    }
+
+    std::mutex mutex;
+    std::map<std::pair<std::string, std::string>, Sample> totals;
+};
+
+inline Report& report(){
+    static Report instance;
+    return instance;
+}
+
+inline std::string currentThreadLabel(){
+    BS::this_thread::optional_index index = BS::this_thread::get_index();
+    return index.has_value() ? "worker " + std::to_string(index.value()) : "main";
+}
+
+// Measures the enclosing scope on the current thread and files the delta under the given phase.
+// Wrap each pool task body in one of these to get per-thread numbers.
+class ScopedCounters {
+public:
+    explicit ScopedCounters(const char* phase) : phase(phase), active(enabled() && threadCounters().available()) {
+        if(active){ start = threadCounters().read(); }
+    }
+
+    ~ScopedCounters(){
+        if(active){ report().add(phase, currentThreadLabel(), difference(threadCounters().read(), start)); }
+    }
+
+    ScopedCounters(const ScopedCounters&) = delete;
+    ScopedCounters& operator=(const ScopedCounters&) = delete;
+
+private:
+    const char* phase;
+    bool active;
+    Sample start;
+};
+
+} // namespace perfcounters
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef PRIMALITY_HPP
+#define PRIMALITY_HPP
+
+/**
+ * Primality of single 64-bit numbers, and of large batches of them, without sieving anything.
+ *
+ * The test is Miller-Rabin with bases that are known to be deterministic: {2, 7, 61} below 2^32, and Jim Sinclair's
+ * seven bases for every 64-bit number. The modular multiplications are done in Montgomery form, which replaces the
+ * 128-by-64-bit division of a plain (a * b) % n with two multiplications, and the numbers are first trial-divided
+ * by the small primes (with multiply-by-inverse divisibility tests, no division either) and looked up in the small
+ * prime table if they are small enough.
+ *
+ * In a batch, the base-2 test, which is where almost every composite is rejected, runs on LANES numbers at once in
+ * lockstep. The lanes' multiplications are independent, so the CPU overlaps their latencies instead of waiting on
+ * one long dependency chain. Large batches are split across the thread pool.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "BS_thread_pool.hpp"
+#include "segmented_sieve.hpp"
+
+namespace primality {
+
+const uint32_t TABLE_LIMIT = 1 << 16;   // numbers below this are answered from the small prime table
+const size_t LANES = 4;                 // numbers tested side by side in a batch
+const size_t PARALLEL_BATCH = 1 << 14;  // batches smaller than this stay on the calling thread
+
+// Arithmetic modulo an odd n in Montgomery form, x standing for x * 2^64 mod n.
+struct Montgomery {
+    uint64_t n;
+    uint64_t inverse;  // n^-1 mod 2^64
+    uint64_t one;      // 2^64 mod n
+    uint64_t r2;       // 2^128 mod n
+
+    explicit Montgomery(uint64_t modulus) : n(modulus) {
+        inverse = n;  // Newton's iteration doubles the correct low bits each step: 3 (n * n = 1 mod 8), 6, ..., 96
+        for(int i = 0; i < 5; i++){ inverse *= 2 - n * inverse; }
+        one = (0 - n) % n;
+        r2 = (uint64_t)((unsigned __int128)one * one % n);
+    }
+
+    // a * b * 2^-64 mod n for a, b < n.
+    uint64_t multiply(uint64_t a, uint64_t b) const {
+        unsigned __int128 t = (unsigned __int128)a * b;
+        uint64_t m = (uint64_t)t * inverse;
+        uint64_t high = (uint64_t)(t >> 64), correction = (uint64_t)(((unsigned __int128)m * n) >> 64);
+        return high >= correction ? high - correction : high - correction + n;
+    }
+
+    uint64_t toMontgomery(uint64_t a) const { return multiply(a % n, r2); }
+
+    uint64_t power(uint64_t base, uint64_t exponent) const {
+        uint64_t result = one;
+        for(; exponent > 0; exponent >>= 1){
+            if(exponent & 1){ result = multiply(result, base); }
+            base = multiply(base, base);
+        }
+        return result;
+    }
+};
+
+// The strong probable prime test to one base, with n - 1 = odd * 2^twos. base is a plain number.
+inline bool strongProbablePrime(const Montgomery &mont, uint64_t base, uint64_t odd, int twos){
+    uint64_t a = base % mont.n;
+    if(a == 0){ return true; }
+    uint64_t minusOne = mont.n - mont.one;
+    uint64_t x = mont.power(mont.toMontgomery(a), odd);
+    if(x == mont.one || x == minusOne){ return true; }
+    for(int i = 1; i < twos; i++){
+        x = mont.multiply(x, x);
+        if(x == minusOne){ return true; }
+    }
+    return false;
+}
+
+// Divisibility by an odd prime p without dividing: n * p^-1 mod 2^64 <= (2^64 - 1) / p exactly when p divides n,
+// and then n * p^-1 mod 2^64 is n / p.
+struct SmallDivisor {
+    uint64_t prime;
+    uint64_t inverse;
+    uint64_t limit;
+};
+
+inline SmallDivisor divisorFor(uint64_t p){
+    uint64_t inverse = p;
+    for(int i = 0; i < 5; i++){ inverse *= 2 - p * inverse; }
+    return {p, inverse, UINT64_MAX / p};
+}
+
+// The odd primes up to 53, which prefilter() trial-divides by.
+inline const std::vector<SmallDivisor>& smallDivisors(){
+    static const std::vector<SmallDivisor> divisors = [] {
+        std::vector<SmallDivisor> list;
+        for(uint64_t p : {3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53}){ list.push_back(divisorFor(p)); }
+        return list;
+    }();
+    return divisors;
+}
+
+inline const std::vector<bool>& smallTable(){
+    static const std::vector<bool> table = [] {
+        std::vector<bool> isPrime(TABLE_LIMIT, false);
+        for(uint32_t p : segsieve::simpleSieve(TABLE_LIMIT - 1)){ isPrime[p] = true; }
+        return isPrime;
+    }();
+    return table;
+}
+
+enum class Filter { Prime, Composite, Unknown };
+
+// Settles small numbers and numbers with a small factor; everything else needs Miller-Rabin.
+inline Filter prefilter(uint64_t n){
+    if(n < TABLE_LIMIT){ return smallTable()[n] ? Filter::Prime : Filter::Composite; }
+    if(n % 2 == 0){ return Filter::Composite; }
+    for(const SmallDivisor &d : smallDivisors()){
+        if(n * d.inverse <= d.limit){ return Filter::Composite; }
+    }
+    return Filter::Unknown;
+}
+
+inline const std::vector<uint64_t>& basesFor(uint64_t n){
+    static const std::vector<uint64_t> below32 = {2, 7, 61};
+    static const std::vector<uint64_t> all64 = {2, 325, 9375, 28178, 450775, 9780504, 1795265022};
+    return n < (1ULL << 32) ? below32 : all64;
+}
+
+// Miller-Rabin with every deterministic base except those in [0, skip) of the list, for an odd n that passed prefilter.
+inline bool millerRabin(uint64_t n, size_t skip = 0){
+    Montgomery mont(n);
+    int twos = __builtin_ctzll(n - 1);
+    uint64_t odd = (n - 1) >> twos;
+    const std::vector<uint64_t> &bases = basesFor(n);
+    for(size_t i = skip; i < bases.size(); i++){
+        if(!strongProbablePrime(mont, bases[i], odd, twos)){ return false; }
+    }
+    return true;
+}
+
+inline bool isPrime(uint64_t n){
+    Filter filter = prefilter(n);
+    return filter == Filter::Unknown ? millerRabin(n) : filter == Filter::Prime;
+}
+
+// The base-2 test for up to LANES numbers at once. The exponents differ, so every lane steps through the longest
+// one and a lane only takes its multiply where its own exponent has a bit; the selects compile to conditional moves.
+inline void strongProbablePrime2(const uint64_t* numbers, size_t count, bool* passed){
+    Montgomery mont[LANES] = {Montgomery(numbers[0]), Montgomery(count > 1 ? numbers[1] : numbers[0]),
+                              Montgomery(count > 2 ? numbers[2] : numbers[0]), Montgomery(count > 3 ? numbers[3] : numbers[0])};
+    uint64_t odd[LANES], result[LANES], base[LANES];
+    int twos[LANES], bits = 0;
+    for(size_t lane = 0; lane < LANES; lane++){
+        twos[lane] = __builtin_ctzll(mont[lane].n - 1);
+        odd[lane] = (mont[lane].n - 1) >> twos[lane];
+        result[lane] = mont[lane].one;
+        base[lane] = mont[lane].toMontgomery(2);
+        bits = std::max(bits, 64 - __builtin_clzll(odd[lane]));
+    }
+    for(int bit = 0; bit < bits; bit++){
+        for(size_t lane = 0; lane < LANES; lane++){
+            uint64_t product = mont[lane].multiply(result[lane], base[lane]);
+            result[lane] = (odd[lane] >> bit) & 1 ? product : result[lane];
+            base[lane] = mont[lane].multiply(base[lane], base[lane]);
+        }
+    }
+    for(size_t lane = 0; lane < count; lane++){
+        uint64_t x = result[lane], minusOne = mont[lane].n - mont[lane].one;
+        bool probablePrime = x == mont[lane].one || x == minusOne;
+        for(int i = 1; i < twos[lane] && !probablePrime; i++){
+            x = mont[lane].multiply(x, x);
+            probablePrime = x == minusOne;
+        }
+        passed[lane] = probablePrime;
+    }
+}
+
+// results[i] = whether numbers[i] is prime, on the calling thread.
+inline void isPrimeBatch(const uint64_t* numbers, size_t count, char* results){
+    uint64_t pending[LANES];
+    size_t pendingIndex[LANES], lanes = 0;
+    auto flush = [&] {
+        bool passed[LANES];
+        strongProbablePrime2(pending, lanes, passed);
+        for(size_t lane = 0; lane < lanes; lane++){
+            results[pendingIndex[lane]] = passed[lane] && millerRabin(pending[lane], 1);
+        }
+        lanes = 0;
+    };
+    for(size_t i = 0; i < count; i++){
+        Filter filter = prefilter(numbers[i]);
+        if(filter != Filter::Unknown){
+            results[i] = filter == Filter::Prime;
+            continue;
+        }
+        pending[lanes] = numbers[i];
+        pendingIndex[lanes++] = i;
+        if(lanes == LANES){ flush(); }
+    }
+    if(lanes > 0){ flush(); }
+}
+
+// The same for a whole vector, split into blocks across the pool when it is large. Waits on the pool.
+inline std::vector<char> isPrimeBatch(BS::thread_pool &pool, const std::vector<uint64_t> &numbers){
+    std::vector<char> results(numbers.size());
+    if(numbers.size() < PARALLEL_BATCH || pool.get_thread_count() == 1){
+        isPrimeBatch(numbers.data(), numbers.size(), results.data());
+        return results;
+    }
+    pool.submit_blocks<size_t>(0, numbers.size(), [&] (size_t first, size_t last) {
+        isPrimeBatch(numbers.data() + first, last - first, results.data() + first);
+    }).wait();
+    return results;
+}
+
+} // namespace primality
+
+#endif
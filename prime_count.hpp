@@ -0,0 +1,102 @@
+#ifndef PRIME_COUNT_HPP
+#define PRIME_COUNT_HPP
+
+/**
+ * pi(x) and the sum of the primes up to x without sieving up to x: Lucy_Hedgehog's combinatorial method.
+ *
+ * Let S(v) be the count (or sum) of the numbers 2..v that have no prime factor below p. It starts out as all of
+ * 2..v, and going from p to the next prime removes the numbers whose smallest prime factor is p:
+ *     S(v) -= S(v / p) - S(p - 1)         (for the sum, the difference is multiplied by p)
+ * for every v >= p^2. Only the values v = x / i ever occur, fewer than 2 sqrt(x) of them, stored as small[v] for
+ * v <= sqrt(x) and large[i] = S(x / i) for i <= sqrt(x). After the last prime up to sqrt(x), large[1] is pi(x).
+ * That is O(x^(3/4)) work and O(sqrt(x)) memory, against O(x) work for the sieve.
+ *
+ * Within one prime's step every update reads only entries the step has not written yet, in the serial order. The
+ * updates are therefore split into blocks whose reads all lie outside the block: large[i] reads large[i * p], so
+ * i in [a, a * p - 1] can be updated in parallel once the blocks below it are done; small[v] reads small[v / p], so
+ * v in [hi / p + 1, hi] can, going down from sqrt(x). Blocks big enough to pay for it are spread over the pool.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "BS_thread_pool.hpp"
+#include "segmented_sieve.hpp"
+
+namespace primecount {
+
+const size_t PARALLEL_BLOCK = 1 << 15;  // updates below this are not worth a round trip through the pool
+
+struct Totals {
+    uint64_t count = 0;
+    segsieve::PrimeSum sum = 0;
+};
+
+// Runs update(first, last) on [first, last], split across the pool if it is big enough.
+template <typename F>
+void forRange(BS::thread_pool &pool, uint64_t first, uint64_t last, F &&update){
+    if(last < first){ return; }
+    if(last - first + 1 < PARALLEL_BLOCK || pool.get_thread_count() == 1){
+        update(first, last);
+        return;
+    }
+    pool.submit_blocks<uint64_t>(first, last + 1, [&] (uint64_t begin, uint64_t end) { update(begin, end - 1); }).wait();
+}
+
+// Count and sum of the primes up to and including x. Waits on the pool, so call it from outside the pool's tasks.
+inline Totals countPrimes(BS::thread_pool &pool, uint64_t x){
+    if(x < 2){ return {}; }
+    using segsieve::PrimeSum;
+    const uint64_t r = segsieve::integerSqrt(x);
+    std::vector<uint64_t> smallCount(r + 1), largeCount(r + 1);
+    std::vector<PrimeSum> smallSum(r + 1), largeSum(r + 1);
+
+    // Before any prime is removed, S(v) counts and sums all of 2..v.
+    forRange(pool, 1, r, [&] (uint64_t first, uint64_t last) {
+        for(uint64_t i = first; i <= last; i++){
+            PrimeSum v = i, w = x / i;
+            smallCount[i] = i - 1;
+            smallSum[i] = v * (v + 1) / 2 - 1;
+            largeCount[i] = x / i - 1;
+            largeSum[i] = w * (w + 1) / 2 - 1;
+        }
+    });
+
+    for(uint64_t p = 2; p <= r; p++){
+        if(smallCount[p] == smallCount[p - 1]){ continue; }  // p is not prime
+        const uint64_t countBelow = smallCount[p - 1];
+        const PrimeSum sumBelow = smallSum[p - 1];
+        const uint64_t square = p * p;
+        const uint64_t largeEnd = std::min(r, x / square);
+
+        for(uint64_t blockLow = 1; blockLow <= largeEnd;){
+            uint64_t blockHigh = std::min(largeEnd, blockLow * p - 1);
+            forRange(pool, blockLow, blockHigh, [&] (uint64_t first, uint64_t last) {
+                for(uint64_t i = first; i <= last; i++){
+                    uint64_t d = i * p;
+                    uint64_t count = d <= r ? largeCount[d] : smallCount[x / d];
+                    PrimeSum sum = d <= r ? largeSum[d] : smallSum[x / d];
+                    largeCount[i] -= count - countBelow;
+                    largeSum[i] -= p * (sum - sumBelow);
+                }
+            });
+            blockLow = blockHigh + 1;
+        }
+
+        for(uint64_t blockHigh = r; blockHigh >= square;){
+            uint64_t blockLow = std::max(square, blockHigh / p + 1);
+            forRange(pool, blockLow, blockHigh, [&] (uint64_t first, uint64_t last) {
+                for(uint64_t v = first; v <= last; v++){
+                    smallCount[v] -= smallCount[v / p] - countBelow;
+                    smallSum[v] -= p * (smallSum[v / p] - sumBelow);
+                }
+            });
+            blockHigh = blockLow - 1;
+        }
+    }
+    return {largeCount[1], largeSum[1]};
+}
+
+} // namespace primecount
+
+#endif
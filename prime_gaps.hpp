@@ -0,0 +1,67 @@
+#ifndef PRIME_GAPS_HPP
+#define PRIME_GAPS_HPP
+
+/**
+ * Gaps between consecutive primes: the histogram of gap lengths and the record (maximal) gaps, the gaps that are
+ * longer than every gap before them, gathered from each segment's bitmap in the same pass as the count and sum.
+ *
+ * A segment walks its set bits in order; the gap between two neighbouring bits i < j is 2 (j - i). It keeps its
+ * first and last prime, so that merging two neighbouring ranges can add the one gap that spans the boundary, and
+ * its own records, which stay records of the merged range only if they beat the left range's longest gap. Both
+ * steps are associative, so the merge runs in the pool's reduction tree.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "segmented_sieve.hpp"
+
+namespace primegaps {
+
+struct Gap {
+    uint64_t prime;   // the prime before the gap
+    uint64_t length;  // next prime - prime
+};
+
+struct GapStats {
+    uint64_t first = 0;               // smallest prime of the range, 0 if it has none
+    uint64_t last = 0;                // largest prime of the range
+    std::vector<uint64_t> histogram;  // histogram[g] = number of gaps of length g; its size is the longest gap + 1
+    std::vector<Gap> records;         // every gap longer than all gaps before it in the range, in order
+};
+
+// Adds the gap between two consecutive primes of a range to its histogram and records.
+inline void addGap(GapStats &stats, uint64_t prime, uint64_t length){
+    if(length >= stats.histogram.size()){ stats.histogram.resize(length + 1); }
+    stats.histogram[length]++;
+    if(stats.records.empty() || length > stats.records.back().length){ stats.records.push_back({prime, length}); }
+}
+
+inline GapStats gapSegment(const segsieve::SegmentView &segment){
+    GapStats stats;
+    segment.forEachPrime([&] (uint64_t prime) {
+        if(stats.first == 0){ stats.first = prime; }
+        else { addGap(stats, stats.last, prime - stats.last); }
+        stats.last = prime;
+    });
+    return stats;
+}
+
+// Combines the statistics of a range with those of the range right after it.
+inline GapStats mergeGaps(const GapStats &left, const GapStats &right){
+    if(left.first == 0){ return right; }
+    if(right.first == 0){ return left; }
+    GapStats merged = left;
+    merged.last = right.last;
+    addGap(merged, left.last, right.first - left.last);
+    if(right.histogram.size() > merged.histogram.size()){ merged.histogram.resize(right.histogram.size()); }
+    for(size_t g = 0; g < right.histogram.size(); g++){ merged.histogram[g] += right.histogram[g]; }
+    for(const Gap &gap : right.records){
+        if(gap.length > merged.records.back().length){ merged.records.push_back(gap); }
+    }
+    return merged;
+}
+
+} // namespace primegaps
+
+#endif
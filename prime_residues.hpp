@@ -0,0 +1,93 @@
+#ifndef PRIME_RESIDUES_HPP
+#define PRIME_RESIDUES_HPP
+
+/**
+ * Primes in arithmetic progressions: pi(x; q, a) and the sum of the primes = a mod q for every residue a at once,
+ * gathered from each segment's bitmap in the same pass as the count and sum.
+ *
+ * The residue of a bit is never divided out. Bit j of word w stands for low + 128 w + 2 j + 1, so a segment keeps
+ * the residue of its current word's first number, steps it by 128 mod q from word to word, and adds (2 j) mod q from
+ * a 64-entry table for the bit, with one conditional subtraction each. That leaves a table increment per prime on
+ * top of the walk over the set bits that the sum already does. Merging two ranges adds their tables entry by entry.
+ *
+ * A table has 24 bytes per residue, up to 1.5 MB at MAX_MODULUS, so the segments of a run do not each get their own:
+ * a ResidueAccumulator keeps one table per pool thread, each segment adds into the table of the thread that sieved
+ * it, and the tables are merged once at the end. Sums of residue classes do not depend on the order of the segments.
+ */
+
+#include <cstdint>
+#include <vector>
+#include "BS_thread_pool.hpp"
+#include "segmented_sieve.hpp"
+
+namespace primeresidues {
+
+const uint64_t MAX_MODULUS = 1 << 16;  // keeps every thread's table within 1.5 MB
+
+struct ResidueTable {
+    uint64_t modulus = 0;                   // 0 for the empty table, which merges as the identity
+    std::vector<uint64_t> counts;           // counts[a] = primes = a mod modulus
+    std::vector<segsieve::PrimeSum> sums;   // sums[a] = their sum
+};
+
+// Adds the primes of a segment to a table with a nonzero modulus.
+inline void addSegment(ResidueTable &table, const segsieve::SegmentView &segment){
+    const uint64_t modulus = table.modulus;
+    if(segment.includesTwo){
+        table.counts[2 % modulus]++;
+        table.sums[2 % modulus] += 2;
+    }
+    uint64_t bitStep[64];
+    for(uint64_t j = 0; j < 64; j++){ bitStep[j] = 2 * j % modulus; }
+    const uint64_t wordStep = 128 % modulus;
+    uint64_t wordResidue = (segment.low + 1) % modulus;
+    for(size_t i = 0; i < segment.wordCount(); i++){
+        for(uint64_t word = segment.words[i]; word != 0; word &= word - 1){
+            int bit = __builtin_ctzll(word);
+            uint64_t residue = wordResidue + bitStep[bit];
+            if(residue >= modulus){ residue -= modulus; }
+            table.counts[residue]++;
+            table.sums[residue] += segment.valueAt(i * 64 + bit);
+        }
+        wordResidue += wordStep;
+        if(wordResidue >= modulus){ wordResidue -= modulus; }
+    }
+}
+
+// Adds right into left, which is taken by value so that a caller can move it in.
+inline ResidueTable mergeResidues(ResidueTable left, const ResidueTable &right){
+    if(left.modulus == 0){ return right; }
+    if(right.modulus == 0){ return left; }
+    for(uint64_t a = 0; a < left.modulus; a++){
+        left.counts[a] += right.counts[a];
+        left.sums[a] += right.sums[a];
+    }
+    return left;
+}
+
+// One table per thread of a pool, for the segments of one run. add() must be called from the pool's threads.
+class ResidueAccumulator {
+public:
+    ResidueAccumulator(size_t threads, uint64_t modulus) : modulus(modulus), tables(threads) {}
+
+    void add(const segsieve::SegmentView &segment){
+        ResidueTable &table = tables[*BS::this_thread::get_index()];
+        if(table.modulus == 0){ table = {modulus, std::vector<uint64_t>(modulus, 0), std::vector<segsieve::PrimeSum>(modulus, 0)}; }
+        addSegment(table, segment);
+    }
+
+    // The merged table of every segment added; empty (modulus 0) if none was. Call it once the segments are done.
+    ResidueTable collect(){
+        ResidueTable total;
+        for(ResidueTable &table : tables){ total = total.modulus == 0 ? std::move(table) : mergeResidues(std::move(total), table); }
+        return total;
+    }
+
+private:
+    uint64_t modulus;
+    std::vector<ResidueTable> tables;
+};
+
+} // namespace primeresidues
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef PRIME_TAIL_HPP
+#define PRIME_TAIL_HPP
+
+/**
+ * Queries about the primes next to one number: the k largest primes up to N, and the previous and next prime of any
+ * 64-bit value, without sieving everything below it.
+ *
+ * The search sieves small windows of WINDOW numbers outward from the query (downward for the largest primes and the
+ * previous prime, upward for the next one) with the segmented engine's kernel, until it has found what it needs.
+ * Below SMALL_PRIME_LIMIT^2 a window is crossed off with every prime up to sqrt(high), a complete sieve. Above it,
+ * the window is only crossed off with the primes up to PREFILTER_LIMIT, which removes five in six odd numbers
+ * for a few hundred divisions, and the survivors are confirmed with a deterministic Miller-Rabin test; that is what
+ * makes queries near 2^64 take microseconds rather than a sieve of the base primes up to 2^32.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "primality.hpp"
+#include "segmented_sieve.hpp"
+
+namespace primetail {
+
+const uint64_t WINDOW = 4096;                // numbers per window, even
+const uint64_t SMALL_PRIME_LIMIT = 1 << 16;  // windows below SMALL_PRIME_LIMIT^2 are sieved exactly
+const uint64_t PREFILTER_LIMIT = 1 << 10;    // windows above it are crossed off with the primes up to here
+
+inline const std::vector<uint32_t>& smallPrimes(){
+    static const std::vector<uint32_t> primes = segsieve::simpleSieve(SMALL_PRIME_LIMIT);
+    return primes;
+}
+
+// Sieves the window [low, high] (low even, at most WINDOW numbers) into words and returns a view of it. Candidates
+// left in it are prime if exact is set on return, and need primality::isPrime() otherwise.
+inline segsieve::SegmentView sieveWindow(uint64_t* words, uint64_t low, uint64_t high, bool &exact){
+    segsieve::fillSegment(words, low, high);
+    const std::vector<uint32_t> &primes = smallPrimes();
+    uint64_t root = segsieve::integerSqrt(high);
+    exact = root <= SMALL_PRIME_LIMIT;
+    const uint32_t* last = std::upper_bound(primes.data(), primes.data() + primes.size(), (uint32_t)(exact ? root : PREFILTER_LIMIT));
+    segsieve::crossOff(words, low, high, primes.data(), last, segsieve::wheelPattern(30));
+    return {words, (size_t)((high - low + 1) / 2), low, high, low <= 2 && high >= 2};
+}
+
+// Calls visit(prime) for the primes <= limit from the top down, until visit returns false or the primes run out.
+template <typename F>
+void forEachPrimeDownFrom(uint64_t limit, F &&visit){
+    uint64_t words[WINDOW / 128 + 1];
+    for(uint64_t high = limit; high >= 2;){
+        uint64_t low = high >= WINDOW ? (high - WINDOW + 2) & ~1ULL : 0;
+        bool exact, more = true;
+        sieveWindow(words, low, high, exact).forEachPrimeDescending([&] (uint64_t candidate) {
+            if(exact || primality::isPrime(candidate)){ more = visit(candidate); }
+            return more;
+        });
+        if(!more || low == 0){ return; }
+        high = low - 1;
+    }
+}
+
+// Calls visit(prime) for the primes >= start in increasing order, until visit returns false or 2^64 is reached.
+template <typename F>
+void forEachPrimeUpFrom(uint64_t start, F &&visit){
+    uint64_t words[WINDOW / 128 + 1];
+    for(uint64_t low = start & ~1ULL;;){
+        uint64_t high = UINT64_MAX - low < WINDOW - 1 ? UINT64_MAX : low + WINDOW - 1;
+        bool exact;
+        segsieve::SegmentView window = sieveWindow(words, low, high, exact);
+        if(window.includesTwo && start <= 2 && !visit((uint64_t)2)){ return; }
+        for(size_t i = 0; i < window.wordCount(); i++){
+            for(uint64_t word = words[i]; word != 0; word &= word - 1){
+                uint64_t candidate = window.valueAt(i * 64 + __builtin_ctzll(word));
+                if(candidate >= start && (exact || primality::isPrime(candidate)) && !visit(candidate)){ return; }
+            }
+        }
+        if(high == UINT64_MAX){ return; }
+        low = high + 1;
+    }
+}
+
+// The k largest primes up to and including limit (fewer if there are not that many), in increasing order.
+inline std::vector<uint64_t> largestPrimes(uint64_t limit, size_t k){
+    std::vector<uint64_t> primes;
+    if(k == 0){ return primes; }
+    forEachPrimeDownFrom(limit, [&] (uint64_t prime) {
+        primes.push_back(prime);
+        return primes.size() < k;
+    });
+    std::reverse(primes.begin(), primes.end());
+    return primes;
+}
+
+// The largest prime below n, or 0 if there is none.
+inline uint64_t prevPrime(uint64_t n){
+    uint64_t found = 0;
+    if(n > 2){
+        forEachPrimeDownFrom(n - 1, [&] (uint64_t prime) {
+            found = prime;
+            return false;
+        });
+    }
+    return found;
+}
+
+// The smallest prime above n, or 0 if there is none below 2^64.
+inline uint64_t nextPrime(uint64_t n){
+    uint64_t found = 0;
+    if(n < UINT64_MAX){
+        forEachPrimeUpFrom(n + 1, [&] (uint64_t prime) {
+            found = prime;
+            return false;
+        });
+    }
+    return found;
+}
+
+} // namespace primetail
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef PRIME_TUPLETS_HPP
+#define PRIME_TUPLETS_HPP
+
+/**
+ * Counts of prime constellations (twin primes, cousin primes and prime triplets), taken straight from the segmented
+ * engine's packed bitmap while the segment is still in cache, so they cost a few word operations per 128 numbers.
+ *
+ * On the odd-only bitmap, p + 2j is j bits after p, so a constellation is a set of bit offsets, and the positions
+ * where all of them are set are an AND of the word shifted right by each offset, with the low bits of the next word
+ * shifted in. Each constellation is counted at its smallest member, once all of its members are in the range.
+ *
+ * A constellation that straddles two segments has no single segment that sees all of it. Each segment therefore
+ * also keeps its first and last EDGE_BITS bits, and merging two neighbouring ranges counts the constellations that
+ * start in the left one's tail and end in the right one's head. The merge is associative, so it works in the pool's
+ * reduction tree like the count and sum.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include "segmented_sieve.hpp"
+
+namespace primetuplets {
+
+struct Pattern {
+    const char* name;
+    uint64_t offsets;  // bit j set: p + 2j is a member
+};
+
+// (3, 5, 7) is the only prime triple (p, p + 2, p + 4) and is not counted as a triplet.
+const Pattern PATTERNS[] = {
+    {"Twin primes (p, p + 2)", 0b11},
+    {"Cousin primes (p, p + 4)", 0b101},
+    {"Prime triplets (p, p + 2, p + 6)", 0b1011},
+    {"Prime triplets (p, p + 4, p + 6)", 0b1101},
+};
+const size_t PATTERN_COUNT = sizeof(PATTERNS) / sizeof(PATTERNS[0]);
+const unsigned EDGE_BITS = 3;  // the widest pattern spans offsets 0 to 3
+
+struct TupletCounts {
+    uint64_t counts[PATTERN_COUNT] = {};
+    uint64_t bits = 0;  // odd numbers covered by the range's bitmap
+    uint64_t head = 0;  // its first min(bits, EDGE_BITS) bits
+    uint64_t tail = 0;  // its last min(bits, EDGE_BITS) bits
+};
+
+// Bits [first, first + count) of the bitmap as the low bits of a word, count < 64.
+inline uint64_t bitsAt(const uint64_t* words, size_t first, size_t count){
+    uint64_t value = 0;
+    for(size_t i = 0; i < count; i++){ value |= ((words[(first + i) / 64] >> ((first + i) % 64)) & 1) << i; }
+    return value;
+}
+
+inline TupletCounts countSegment(const segsieve::SegmentView &segment){
+    TupletCounts tuplets;
+    tuplets.bits = segment.bitCount;
+    size_t edge = std::min<size_t>(segment.bitCount, EDGE_BITS);
+    tuplets.head = bitsAt(segment.words, 0, edge);
+    tuplets.tail = bitsAt(segment.words, segment.bitCount - edge, edge);
+
+    // Bits past bitCount are zero, and so is the word after the last one, so nothing is counted across the end.
+    // The counts are in PATTERNS order; plusN has bit i set if low + 2i + 1 + N is prime.
+    const size_t wordCount = segment.wordCount();
+    for(size_t i = 0; i < wordCount; i++){
+        uint64_t word = segment.words[i], next = i + 1 < wordCount ? segment.words[i + 1] : 0;
+        uint64_t plus2 = (word >> 1) | (next << 63), plus4 = (word >> 2) | (next << 62), plus6 = (word >> 3) | (next << 61);
+        uint64_t twins = word & plus2, cousins = word & plus4;
+        tuplets.counts[0] += __builtin_popcountll(twins);
+        tuplets.counts[1] += __builtin_popcountll(cousins);
+        tuplets.counts[2] += __builtin_popcountll(twins & plus6);
+        tuplets.counts[3] += __builtin_popcountll(cousins & plus6);
+    }
+    return tuplets;
+}
+
+// Combines the counts of a range with those of the range right after it.
+inline TupletCounts mergeTuplets(const TupletCounts &left, const TupletCounts &right){
+    if(left.bits == 0){ return right; }
+    if(right.bits == 0){ return left; }
+    TupletCounts merged;
+    for(size_t k = 0; k < PATTERN_COUNT; k++){ merged.counts[k] = left.counts[k] + right.counts[k]; }
+    merged.bits = left.bits + right.bits;
+
+    // The bits around the boundary: left's tail, then right's head.
+    unsigned leftEdge = (unsigned)std::min<uint64_t>(left.bits, EDGE_BITS), rightEdge = (unsigned)std::min<uint64_t>(right.bits, EDGE_BITS);
+    uint64_t joined = left.tail | right.head << leftEdge;
+    for(size_t k = 0; k < PATTERN_COUNT; k++){
+        unsigned span = 64 - __builtin_clzll(PATTERNS[k].offsets);
+        for(unsigned start = 0; start < leftEdge; start++){
+            bool crosses = start + span > leftEdge, fits = start + span <= leftEdge + rightEdge;
+            if(crosses && fits && ((joined >> start) & PATTERNS[k].offsets) == PATTERNS[k].offsets){ merged.counts[k]++; }
+        }
+    }
+
+    unsigned edge = (unsigned)std::min<uint64_t>(merged.bits, EDGE_BITS);
+    uint64_t mask = (1ULL << edge) - 1;
+    merged.head = left.bits >= edge ? left.head : (left.head | right.head << left.bits) & mask;
+    merged.tail = right.bits >= edge ? right.tail : (joined >> (leftEdge + rightEdge - edge)) & mask;
+    return merged;
+}
+
+} // namespace primetuplets
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef RANGE_PLANNER_HPP
+#define RANGE_PLANNER_HPP
+
+/**
+ * Answering many range queries at once with one shared sieve.
+ *
+ * Sieving each query on its own sieves the numbers they have in common once per query, and sieves the base primes
+ * once per query too. The planner first merges the queries' ranges into their union (overlapping and adjacent ranges
+ * become one interval) and lays segments over the union, so every number is sieved once however many queries ask
+ * for it. The segments are then sieved on the pool with one BasePrimeTable up to the square root of the highest
+ * query. Each segment knows which queries overlap it, and the worker that sieved it summarizes the part of it that
+ * lies in each of those queries while the bitmap is still in cache. Each query's parts are finally merged in segment
+ * order.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "BS_thread_pool.hpp"
+#include "segmented_sieve.hpp"
+
+namespace rangeplanner {
+
+struct RangeQuery {
+    uint64_t low = 0;
+    uint64_t high = 0;  // inclusive
+};
+
+struct PlannedSegment {
+    uint64_t low = 0;                // even
+    uint64_t high = 0;
+    std::vector<uint32_t> queries;   // the queries that overlap it
+};
+
+struct QueryPlan {
+    std::vector<RangeQuery> merged;       // the union of the queries: sorted, disjoint and not adjacent
+    std::vector<PlannedSegment> segments;
+    uint64_t requested = 0;               // numbers asked for, summed over the queries
+    uint64_t scheduled = 0;               // numbers the segments cover
+};
+
+// Count, sum and largest primes of the numbers of a segment that lie in [low, high].
+inline segsieve::PrimeSummary summarizeClipped(const segsieve::SegmentView &segment, uint64_t low, uint64_t high){
+    segsieve::PrimeSummary two, odd;
+    if(segment.includesTwo && low <= 2 && high >= 2){ two = {1, 2, {2}}; }
+    if(high <= segment.low || segment.bitCount == 0){ return two; }
+    uint64_t first = low <= segment.low ? 0 : (low - segment.low) / 2;             // first odd number >= low
+    uint64_t last = std::min<uint64_t>(segment.bitCount - 1, (high - segment.low - 1) / 2);  // last odd number <= high
+    if(first > last){ return two; }
+    auto wordAt = [&] (size_t w) {
+        uint64_t word = segment.words[w];
+        if(w == first / 64){ word &= ~0ULL << (first % 64); }
+        if(w == last / 64 && last % 64 != 63){ word &= (2ULL << (last % 64)) - 1; }
+        return word;
+    };
+    for(size_t w = first / 64; w <= last / 64; w++){
+        uint64_t word = wordAt(w);
+        odd.count += __builtin_popcountll(word);
+        for(; word != 0; word &= word - 1){ odd.sum += segment.valueAt(w * 64 + __builtin_ctzll(word)); }
+    }
+    for(size_t w = last / 64 + 1; w-- > first / 64 && odd.largest.size() < segsieve::TOP_PRIMES;){
+        for(uint64_t word = wordAt(w); word != 0 && odd.largest.size() < segsieve::TOP_PRIMES;){
+            int bit = 63 - __builtin_clzll(word);
+            odd.largest.push_back(segment.valueAt(w * 64 + bit));
+            word &= ~(1ULL << bit);
+        }
+    }
+    std::reverse(odd.largest.begin(), odd.largest.end());
+    return segsieve::mergeSummaries(two, odd);
+}
+
+// Checks queries before they are planned: every query needs low <= high, and the numbers asked for must add up to
+// less than 2^64 so that the plan can count them. Bounds up to 2^64 - 1 are fine, since crossOff() stops before a
+// multiple could pass 2^64. Returns false with a message on out for the first query that fails.
+inline bool checkQueries(const std::vector<RangeQuery> &queries, std::ostream &out){
+    uint64_t requested = 0;
+    for(const RangeQuery &query : queries){
+        if(query.low > query.high){
+            out << "range [" << query.low << ", " << query.high << "] is empty: its low end is above its high end" << std::endl;
+            return false;
+        }
+        if(query.high - query.low >= UINT64_MAX - requested){
+            out << "the ranges cover 2^64 numbers or more in total, up to [" << query.low << ", " << query.high << "]" << std::endl;
+            return false;
+        }
+        requested += query.high - query.low + 1;
+    }
+    return true;
+}
+
+inline QueryPlan planQueries(const std::vector<RangeQuery> &queries, const segsieve::SieveConfig &config){
+    QueryPlan plan;
+    std::vector<RangeQuery> sorted;
+    for(const RangeQuery &query : queries){
+        if(query.low > query.high){ continue; }
+        sorted.push_back(query);
+        plan.requested += query.high - query.low + 1;
+    }
+    std::sort(sorted.begin(), sorted.end(), [] (const RangeQuery &a, const RangeQuery &b) { return a.low < b.low; });
+    for(const RangeQuery &query : sorted){
+        if(!plan.merged.empty() && (plan.merged.back().high == UINT64_MAX || query.low <= plan.merged.back().high + 1)){
+            plan.merged.back().high = std::max(plan.merged.back().high, query.high);
+        } else {
+            plan.merged.push_back(query);
+        }
+    }
+
+    // An interval that starts on an odd number starts its first segment one below, which the previous interval,
+    // ending at least two below, never covers.
+    const uint64_t span = segsieve::segmentSpan(config);
+    for(const RangeQuery &interval : plan.merged){
+        for(uint64_t low = interval.low & ~1ULL;; low += span){
+            uint64_t high = interval.high - low < span ? interval.high : low + span - 1;
+            plan.segments.push_back({low, high, {}});
+            plan.scheduled += high - std::max(low, interval.low) + 1;
+            if(high == interval.high){ break; }
+        }
+    }
+    for(uint32_t q = 0; q < queries.size(); q++){
+        if(queries[q].low > queries[q].high){ continue; }
+        auto segment = std::lower_bound(plan.segments.begin(), plan.segments.end(), queries[q].low,
+                                        [] (const PlannedSegment &s, uint64_t value) { return s.high < value; });
+        for(; segment != plan.segments.end() && segment->low <= queries[q].high; ++segment){ segment->queries.push_back(q); }
+    }
+    return plan;
+}
+
+// The summary of every query, in the order given (empty for a query with low > high). The base primes come from a
+// table started with a limit of at least the square root of the highest query. Waits on the pool.
+inline std::vector<segsieve::PrimeSummary> answerQueries(BS::thread_pool &pool, segsieve::BasePrimeTable &basePrimes, const std::vector<RangeQuery> &queries,
+                                                         const segsieve::SieveConfig &config, const QueryPlan &plan){
+    std::vector<segsieve::PrimeSummary> answers(queries.size());
+    if(plan.segments.empty()){ return answers; }
+    const uint64_t span = segsieve::segmentSpan(config);
+    BS::multi_future<std::vector<segsieve::PrimeSummary>> futures = pool.submit_sequence<size_t>(0, plan.segments.size(), [&] (size_t index) {
+        const PlannedSegment &planned = plan.segments[index];
+        uint64_t* buffer = segsieve::segmentBuffer(span / 128 + 1);
+        size_t bitCount = (size_t)((planned.high - planned.low + 1) / 2);
+        if(bitCount > 0){ basePrimes.sieve(buffer, planned.low, planned.high, segsieve::wheelPattern(config.wheel)); }
+        segsieve::SegmentView segment{buffer, bitCount, planned.low, planned.high, planned.low <= 2 && planned.high >= 2};
+        std::vector<segsieve::PrimeSummary> parts;
+        for(uint32_t q : planned.queries){ parts.push_back(summarizeClipped(segment, queries[q].low, queries[q].high)); }
+        return parts;
+    });
+    std::vector<std::vector<segsieve::PrimeSummary>> parts = futures.get();
+    for(size_t index = 0; index < parts.size(); index++){
+        for(size_t j = 0; j < parts[index].size(); j++){
+            uint32_t q = plan.segments[index].queries[j];
+            answers[q] = segsieve::mergeSummaries(answers[q], parts[index][j]);
+        }
+    }
+    return answers;
+}
+
+inline std::vector<segsieve::PrimeSummary> answerQueries(BS::thread_pool &pool, const std::vector<RangeQuery> &queries,
+                                                         const segsieve::SieveConfig &config, const QueryPlan &plan){
+    segsieve::BasePrimeTable basePrimes;
+    if(!plan.segments.empty()){ basePrimes.start(pool, segsieve::integerSqrt(plan.merged.back().high), config); }
+    return answerQueries(pool, basePrimes, queries, config, plan);
+}
+
+inline std::vector<segsieve::PrimeSummary> answerQueries(BS::thread_pool &pool, const std::vector<RangeQuery> &queries, const segsieve::SieveConfig &config){
+    return answerQueries(pool, queries, config, planQueries(queries, config));
+}
+
+} // namespace rangeplanner
+
+#endif
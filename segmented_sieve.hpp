@@ -0,0 +1,517 @@
+#ifndef SEGMENTED_SIEVE_HPP
+#define SEGMENTED_SIEVE_HPP
+
+/**
+ * Cache-sized segmented Sieve of Eratosthenes over 64-bit ranges.
+ *
+ * Unlike the wheel pipeline in main.cpp, which gives every thread one large vector<bool> chunk, this engine walks the
+ * range in small segments that fit in L1/L2 and hands them out to the thread pool one at a time. Each segment is a
+ * packed bitmap of the odd numbers only: bit i of a segment starting at the even number low stands for low + 2i + 1.
+ *
+ * Crossing off uses a wheel: with wheel 30 the multiples p*k with k divisible by 2, 3 or 5 are skipped (they are
+ * crossed off by 3 and 5 themselves), with wheel 210 also those with k divisible by 7, and wheel 2 only skips even k.
+ *
+ * What is done with a finished segment is up to the caller: sieveRange() runs an "extract" function on every
+ * segment and returns the per-segment results in order, so counting, listing and statistics all share one kernel.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "sieve_profiler.hpp"  // first, so that SIEVE_PROFILE builds get the pool's profiling hooks
+#include "BS_thread_pool.hpp"
+#include "perf_counters.hpp"
+#include "sieve_arena.hpp"
+
+namespace segsieve {
+
+struct SieveConfig {
+    unsigned threads = 8;
+    uint64_t segmentBytes = 32 * 1024;  // bitmap bytes per segment; each byte covers 16 numbers
+    unsigned wheel = 30;                // 2, 30 or 210
+};
+
+const size_t TOP_PRIMES = 10;  // how many of the largest primes the summaries keep
+
+// Sums of primes pass 2^64 a little above 10^10 (and a single segment's sum can too, near 2^64), so every sum is
+// accumulated exactly in 128 bits: p < 2^64 and fewer than 2^64 primes keep the total below 2^128.
+using PrimeSum = unsigned __int128;
+
+inline std::string sumToString(PrimeSum sum){
+    std::string digits;
+    do {
+        digits.insert(digits.begin(), (char)('0' + (int)(sum % 10)));
+        sum /= 10;
+    } while(sum != 0);
+    return digits;
+}
+
+// Parses a decimal written by sumToString. Returns false on anything else, including values of 2^128 and above.
+inline bool parseSum(const std::string &text, PrimeSum &sum){
+    if(text.empty() || text.size() > 39){ return false; }
+    PrimeSum value = 0;
+    for(char c : text){
+        if(c < '0' || c > '9'){ return false; }
+        PrimeSum next = value * 10 + (PrimeSum)(c - '0');
+        if(next / 10 != value){ return false; }
+        value = next;
+    }
+    sum = value;
+    return true;
+}
+
+inline uint64_t integerSqrt(uint64_t n){
+    uint64_t root = (uint64_t)sqrtl((long double)n);
+    while(root > UINT32_MAX || root * root > n){ root--; }  // roots above 2^32 - 1 would overflow the squares
+    while(root < UINT32_MAX && (root + 1) * (root + 1) <= n){ root++; }
+    return root;
+}
+
+// Primes up to and including limit with a plain odd-only sieve. Only used for the base primes (limit ~ sqrt(high)).
+inline std::vector<uint32_t> simpleSieve(uint64_t limit){
+    std::vector<uint32_t> primes;
+    if(limit < 2){ return primes; }
+    primes.push_back(2);
+    std::vector<bool> composite(limit / 2 + 1, false);  // index i stands for 2i + 1
+    for(uint64_t i = 1; 2 * i + 1 <= limit; i++){
+        if(composite[i]){ continue; }
+        uint64_t value = 2 * i + 1;
+        primes.push_back((uint32_t)value);
+        for(uint64_t j = value * value; j <= limit; j += 2 * value){ composite[j / 2] = true; }
+    }
+    return primes;
+}
+
+// The multipliers k that are coprime to the wheel modulus, stored as the gaps between consecutive ones,
+// plus a lookup from any residue to the first coprime residue at or after it.
+struct WheelPattern {
+    unsigned modulus;
+    std::vector<uint32_t> residues;
+    std::vector<uint32_t> gaps;        // gaps[i] = residues[i + 1] - residues[i], wrapping around the modulus
+    std::vector<uint32_t> nextIndex;   // nextIndex[r] = first i with residues[i] >= r, or residues.size() to wrap
+
+    explicit WheelPattern(unsigned modulus) : modulus(modulus) {
+        for(unsigned r = 1; r < modulus; r++){
+            if(r % 2 != 0 && (modulus % 3 != 0 || r % 3 != 0) && (modulus % 5 != 0 || r % 5 != 0) && (modulus % 7 != 0 || r % 7 != 0)){
+                residues.push_back(r);
+            }
+        }
+        for(size_t i = 0; i < residues.size(); i++){
+            gaps.push_back(i + 1 < residues.size() ? residues[i + 1] - residues[i] : modulus + residues[0] - residues[i]);
+        }
+        for(uint32_t r = 0; r <= modulus; r++){
+            nextIndex.push_back((uint32_t)(std::lower_bound(residues.begin(), residues.end(), r) - residues.begin()));
+        }
+    }
+
+    // Smallest prime that is not a factor of the modulus; primes below it are crossed off with the plain odd wheel.
+    uint32_t firstWheelPrime() const { return modulus == 2 ? 3 : modulus == 30 ? 7 : 11; }
+};
+
+inline const WheelPattern& wheelPattern(unsigned modulus){
+    static const WheelPattern odd(2), wheel30(30), wheel210(210);
+    return modulus == 210 ? wheel210 : modulus == 30 ? wheel30 : odd;
+}
+
+// A finished segment: the odd numbers in [low + 1, low + 2 * bitCount - 1] as bits, plus 2 if the range included it.
+struct SegmentView {
+    const uint64_t* words;
+    size_t bitCount;
+    uint64_t low;       // even
+    uint64_t high;      // last number of the range this segment covers (inclusive)
+    bool includesTwo;
+
+    uint64_t valueAt(size_t bit) const { return low + 2 * bit + 1; }
+    size_t wordCount() const { return (bitCount + 63) / 64; }
+
+    uint64_t countPrimes() const {
+        uint64_t count = includesTwo ? 1 : 0;
+        for(size_t i = 0; i < wordCount(); i++){ count += __builtin_popcountll(words[i]); }
+        return count;
+    }
+
+    template <typename F>
+    void forEachPrime(F &&visit) const {
+        if(includesTwo){ visit((uint64_t)2); }
+        for(size_t i = 0; i < wordCount(); i++){
+            uint64_t word = words[i];
+            while(word != 0){
+                visit(valueAt(i * 64 + __builtin_ctzll(word)));
+                word &= word - 1;
+            }
+        }
+    }
+
+    // Same as forEachPrime, but from the top down; stops as soon as visit returns false.
+    template <typename F>
+    void forEachPrimeDescending(F &&visit) const {
+        for(size_t i = wordCount(); i-- > 0;){
+            uint64_t word = words[i];
+            while(word != 0){
+                int bit = 63 - __builtin_clzll(word);
+                if(!visit(valueAt(i * 64 + bit))){ return; }
+                word &= ~(1ULL << bit);
+            }
+        }
+        if(includesTwo){ visit((uint64_t)2); }
+    }
+};
+
+// Marks every odd number of [low, high] (low even) as a prime candidate, except 1.
+inline void fillSegment(uint64_t* words, uint64_t low, uint64_t high){
+    size_t bitCount = (high - low + 1) / 2;
+    size_t wordCount = (bitCount + 63) / 64;
+    std::memset(words, 0xff, wordCount * sizeof(uint64_t));
+    if(bitCount % 64 != 0){ words[wordCount - 1] = (1ULL << (bitCount % 64)) - 1; }
+    if(low == 0){ words[0] &= ~1ULL; }  // 1 is not prime
+}
+
+// Crosses off the multiples of the base primes in [first, last) from a filled segment; stops at the first p with p*p > high.
+// Returns false if it stopped early, i.e. the remaining base primes cannot matter for this segment either.
+inline bool crossOff(uint64_t* words, uint64_t low, uint64_t high, const uint32_t* first, const uint32_t* last, const WheelPattern &wheel){
+    const WheelPattern &odd = wheelPattern(2);
+    for(const uint32_t* it = first; it != last; ++it){
+        uint64_t prime = *it;
+        if(prime == 2){ continue; }  // the bitmap only holds odd numbers
+        if(prime * prime > high){ return false; }  // base primes are below 2^32, so the square cannot wrap
+        const WheelPattern &pattern = prime < wheel.firstWheelPrime() ? odd : wheel;
+
+        // First multiplier k >= prime whose multiple lies in the segment, moved forward to the next one on the wheel.
+        // Near 2^64 the multiples can pass 2^64, so both the first one and every step are compared with high before
+        // they are formed rather than after.
+        uint64_t k = std::max<uint64_t>(prime, low / prime + (low % prime != 0));
+        uint64_t base = k - k % pattern.modulus;
+        uint32_t index = pattern.nextIndex[k % pattern.modulus];
+        if(index == pattern.residues.size()){
+            base += pattern.modulus;
+            index = 0;
+        }
+        uint64_t multiplier = base + pattern.residues[index];
+        if(multiplier > high / prime){ continue; }
+        uint64_t multiple = prime * multiplier;
+        const uint32_t* gaps = pattern.gaps.data();
+        uint32_t spokes = (uint32_t)pattern.gaps.size();
+        for(;;){
+            uint64_t bit = (multiple - low) >> 1;
+            words[bit >> 6] &= ~(1ULL << (bit & 63));
+            uint64_t step = prime * gaps[index];
+            if(multiple > high - step){ break; }
+            multiple += step;
+            if(++index == spokes){ index = 0; }
+        }
+    }
+    return true;
+}
+
+// Fills words with the sieved odd numbers of [low, high], low even, using base primes up to sqrt(high).
+inline void sieveSegment(uint64_t* words, uint64_t low, uint64_t high, const std::vector<uint32_t> &basePrimes, const WheelPattern &wheel){
+    fillSegment(words, low, high);
+    crossOff(words, low, high, basePrimes.data(), basePrimes.data() + basePrimes.size(), wheel);
+}
+
+// Per-thread segment buffer, page aligned and drawn from the arena, reused between segments and between runs.
+inline uint64_t* segmentBuffer(size_t words){
+    return sievearena::threadBuffer<uint64_t>(words);
+}
+
+// Arena bytes a run needs for its segment buffers: one page-rounded buffer per thread, plus slack.
+inline size_t arenaBytes(const SieveConfig &config){
+    return config.threads * sievearena::roundUp(config.segmentBytes + sizeof(uint64_t), sievearena::PAGE_SIZE) + sievearena::PAGE_SIZE;
+}
+
+inline uint64_t segmentSpan(const SieveConfig &config){
+    return std::max<uint64_t>(config.segmentBytes, 8) * 16;  // numbers per segment, always even
+}
+
+inline size_t segmentCount(uint64_t low, uint64_t high, const SieveConfig &config){
+    if(high < low){ return 0; }
+    uint64_t alignedLow = low & ~1ULL;
+    return (size_t)((high - alignedLow) / segmentSpan(config) + 1);
+}
+
+// The base primes up to sqrt(high), produced in parallel by sieving [0, sqrt(high)] segment by segment on the pool
+// (whose own base primes, up to the fourth root, come from simpleSieve). Each base segment publishes its primes as
+// a separate block; the blocks are ready in order, so a segment of the main range can start as soon as the blocks
+// up to the square root of its own upper end are done, while later base segments are still being sieved.
+class BasePrimeTable {
+public:
+    BasePrimeTable() = default;
+    BasePrimeTable(const BasePrimeTable&) = delete;
+    BasePrimeTable& operator=(const BasePrimeTable&) = delete;
+    ~BasePrimeTable(){ pending.wait(); }
+
+    // Queues the base segments on the pool and returns immediately. Queue these before any task that calls waitFor(),
+    // so that the pool, which runs tasks in order, never has every worker waiting on base segments that are not running.
+    // With BS_THREAD_POOL_ENABLE_PRIORITY the queue is no longer in order, so the base segments get the highest
+    // priority instead; segments that wait for them must then be submitted with a lower one. Call it from outside the
+    // pool: a worker that starts a table and then waits for the segments that use it holds a thread they may need.
+    // Base segments that have not started when the token is cancelled are skipped, like the segments that need them.
+    void start(BS::thread_pool &pool, uint64_t limit, const SieveConfig &config, const BS::cancel_token &token = BS::cancel_token()){
+        assert(BS::this_thread::get_pool() != &pool && "BasePrimeTable::start() called from a task of the same pool");
+        coveredLimit = limit;
+        uint64_t span = segmentSpan(config);
+        size_t segments = (size_t)(limit / span + 1);
+        blocks.assign(segments, {});
+        blockHigh.resize(segments);
+        finished.assign(segments, 0);
+        readyBlocks = 0;
+        for(size_t i = 0; i < segments; i++){ blockHigh[i] = std::min(limit, i * span + span - 1); }
+        if(segments == 1){  // nothing to overlap, just sieve it here
+            SIEVE_PROFILE_PHASE("baseSegment");
+            perfcounters::ScopedCounters counters("baseSegment");
+            blocks[0] = simpleSieve(limit);
+            readyBlocks = 1;
+            return;
+        }
+        std::shared_ptr<std::vector<uint32_t>> smallPrimes = std::make_shared<std::vector<uint32_t>>(simpleSieve(integerSqrt(limit)));
+        // A named lambda, so that submit_sequence copies it into every task instead of moving it into the first one.
+        auto sieveBase = [this, smallPrimes, span, limit, config, token] (size_t index) {
+            if(token.cancelled()){
+                abandon();
+                return;
+            }
+            SIEVE_PROFILE_PHASE("baseSegment");
+            perfcounters::ScopedCounters counters("baseSegment");
+            uint64_t segmentLow = index * span;
+            uint64_t segmentHigh = std::min(limit, segmentLow + span - 1);
+            uint64_t* buffer = segmentBuffer(span / 128 + 1);
+            sieveSegment(buffer, segmentLow, segmentHigh, *smallPrimes, wheelPattern(config.wheel));
+            std::vector<uint32_t> found;
+            SegmentView{buffer, (size_t)((segmentHigh - segmentLow + 1) / 2), segmentLow, segmentHigh, index == 0 && limit >= 2}
+                .forEachPrime([&] (uint64_t prime) { found.push_back((uint32_t)prime); });
+            publish(index, std::move(found));
+        };
+#ifdef BS_THREAD_POOL_ENABLE_PRIORITY
+        pending = pool.submit_sequence<size_t>(0, segments, sieveBase, BS::pr::highest);
+#else
+        pending = pool.submit_sequence<size_t>(0, segments, sieveBase);
+#endif
+    }
+
+    // The largest base prime the table will hold, once every block is ready.
+    uint64_t limit() const { return coveredLimit; }
+
+    // Blocks until every base prime up to value is available. Throws BS::task_cancelled if a base segment it needs
+    // was skipped, which the cancellable submit overloads report as a skipped task. Segments call this on the pool's
+    // workers; that only blocks a worker for as long as a base segment queued ahead of it (see start()) is running.
+    void waitFor(uint64_t value){
+        std::unique_lock lock(mutex);
+        auto available = [&] { return readyBlocks == blocks.size() || (readyBlocks > 0 && blockHigh[readyBlocks - 1] >= value); };
+        ready.wait(lock, [&] { return available() || abandoned; });
+        if(!available()){ throw BS::task_cancelled(); }
+    }
+
+    // Sieves segment [low, high] (low even) with every base prime it needs, waiting for them if necessary.
+    void sieve(uint64_t* words, uint64_t low, uint64_t high, const WheelPattern &wheel){
+        fillSegment(words, low, high);
+        uint64_t root = integerSqrt(high);
+        waitFor(root);
+        for(size_t i = 0; i < blocks.size(); i++){  // only the blocks waitFor() made sure of
+            const std::vector<uint32_t> &block = blocks[i];
+            if(!crossOff(words, low, high, block.data(), block.data() + block.size(), wheel) || blockHigh[i] >= root){ break; }
+        }
+    }
+
+private:
+    void publish(size_t index, std::vector<uint32_t> &&primes){
+        const std::scoped_lock lock(mutex);
+        blocks[index] = std::move(primes);
+        finished[index] = 1;
+        while(readyBlocks < blocks.size() && finished[readyBlocks]){ readyBlocks++; }
+        ready.notify_all();
+    }
+
+    void abandon(){
+        const std::scoped_lock lock(mutex);
+        abandoned = true;
+        ready.notify_all();
+    }
+
+    std::vector<std::vector<uint32_t>> blocks;
+    std::vector<uint64_t> blockHigh;
+    std::vector<char> finished;
+    size_t readyBlocks = 0;
+    uint64_t coveredLimit = 0;
+    bool abandoned = false;
+    std::mutex mutex;
+    std::condition_variable ready;
+    BS::multi_future<void> pending;
+};
+
+// Sieves segment number index of [low, high] into the calling thread's buffer and returns a view of it.
+inline SegmentView sieveSegmentAt(size_t index, uint64_t low, uint64_t high, BasePrimeTable &basePrimes, const SieveConfig &config){
+    SIEVE_PROFILE_PHASE("sieveSegment");
+    perfcounters::ScopedCounters counters("sieveSegment");
+    uint64_t span = segmentSpan(config);
+    uint64_t segmentLow = (low & ~1ULL) + index * span;
+    uint64_t segmentHigh = high - segmentLow < span ? high : segmentLow + span - 1;  // no wrap for segments near 2^64
+    size_t bitCount = (size_t)((segmentHigh - segmentLow + 1) / 2);
+    uint64_t* buffer = segmentBuffer(span / 128 + 1);
+    if(bitCount > 0){ basePrimes.sieve(buffer, segmentLow, segmentHigh, wheelPattern(config.wheel)); }
+    return {buffer, bitCount, segmentLow, segmentHigh, index == 0 && low <= 2 && high >= 2};
+}
+
+// Sieves [low, high] segment by segment on the pool and returns extract(segment) for every segment, in order.
+// The base primes are sieved on the same pool just ahead of the segments that need them.
+template <typename Extract>
+std::vector<std::invoke_result_t<Extract&, const SegmentView&>> sieveRange(BS::thread_pool &pool, uint64_t low, uint64_t high, const SieveConfig &config, Extract extract){
+    using Result = std::invoke_result_t<Extract&, const SegmentView&>;
+    size_t segments = segmentCount(low, high, config);
+    if(segments == 0){ return {}; }
+    BasePrimeTable basePrimes;
+    basePrimes.start(pool, integerSqrt(high), config);
+    BS::multi_future<Result> futures = pool.submit_sequence<size_t>(0, segments, [&] (size_t index) {
+        SegmentView segment = sieveSegmentAt(index, low, high, basePrimes, config);
+        SIEVE_PROFILE_PHASE("extractSegment");
+        perfcounters::ScopedCounters counters("extractSegment");
+        return extract(segment);
+    });
+    return futures.get();
+}
+
+// Like sieveRange, but instead of returning every segment's result, merges them with the pool's submit_reduce: a
+// tree of merge(left, right) calls that runs on the workers as the segments finish. merge must be associative. The
+// base primes come from a table that has been started with a limit of at least sqrt(high), such as one kept across
+// calls.
+template <typename Extract, typename Merge>
+std::invoke_result_t<Extract&, const SegmentView&> reduceRange(BS::thread_pool &pool, BasePrimeTable &basePrimes, uint64_t low, uint64_t high, const SieveConfig &config,
+                                                               Extract extract, Merge merge){
+    using Result = std::invoke_result_t<Extract&, const SegmentView&>;
+    size_t segments = segmentCount(low, high, config);
+    if(segments == 0){ return Result(); }
+    return pool.submit_reduce<size_t>(0, segments, [&] (size_t index) {
+        SegmentView segment = sieveSegmentAt(index, low, high, basePrimes, config);
+        SIEVE_PROFILE_PHASE("extractSegment");
+        perfcounters::ScopedCounters counters("extractSegment");
+        return extract(segment);
+    }, [&] (Result left, const Result &right) {
+        SIEVE_PROFILE_PHASE("mergeSegments");
+        perfcounters::ScopedCounters counters("mergeSegments");
+        return merge(std::move(left), right);
+    }).get();
+}
+
+template <typename Extract, typename Merge>
+std::invoke_result_t<Extract&, const SegmentView&> reduceRange(BS::thread_pool &pool, uint64_t low, uint64_t high, const SieveConfig &config, Extract extract, Merge merge){
+    using Result = std::invoke_result_t<Extract&, const SegmentView&>;
+    if(segmentCount(low, high, config) == 0){ return Result(); }
+    BasePrimeTable basePrimes;
+    basePrimes.start(pool, integerSqrt(high), config);
+    return reduceRange(pool, basePrimes, low, high, config, extract, merge);
+}
+
+// Calls visit(batchLow, batchHigh) for consecutive batches of batchSegments segments covering [low, high], so that
+// long ranges can be sieved a bounded piece at a time, with a point between pieces to save progress. low must be
+// even so that the batches keep the segment boundaries of one long run.
+template <typename Visit>
+void forEachBatch(uint64_t low, uint64_t high, const SieveConfig &config, size_t batchSegments, Visit visit){
+    uint64_t batchSpan = segmentSpan(config) * batchSegments;
+    for(uint64_t batchLow = low; batchLow <= high; batchLow += batchSpan){
+        uint64_t batchHigh = high - batchLow < batchSpan ? high : batchLow + batchSpan - 1;
+        visit(batchLow, batchHigh);
+        if(batchHigh == high){ break; }
+    }
+}
+
+// Count, sum and the largest few primes of a range.
+struct PrimeSummary {
+    uint64_t count = 0;
+    PrimeSum sum = 0;
+    std::vector<uint64_t> largest;  // up to TOP_PRIMES, increasing
+};
+
+inline PrimeSummary summarizeSegment(const SegmentView &segment){
+    PrimeSummary summary;
+    summary.count = segment.countPrimes();
+    segment.forEachPrime([&] (uint64_t prime) { summary.sum += prime; });
+    segment.forEachPrimeDescending([&] (uint64_t prime) {
+        summary.largest.push_back(prime);
+        return summary.largest.size() < TOP_PRIMES;
+    });
+    std::reverse(summary.largest.begin(), summary.largest.end());
+    return summary;
+}
+
+// Combines the summary of a range with the summary of the range right after it.
+inline PrimeSummary mergeSummaries(const PrimeSummary &left, const PrimeSummary &right){
+    PrimeSummary merged;
+    merged.count = left.count + right.count;
+    merged.sum = left.sum + right.sum;
+    size_t fromLeft = right.largest.size() >= TOP_PRIMES ? 0 : std::min(left.largest.size(), TOP_PRIMES - right.largest.size());
+    merged.largest.assign(left.largest.end() - fromLeft, left.largest.end());
+    merged.largest.insert(merged.largest.end(), right.largest.begin(), right.largest.end());
+    return merged;
+}
+
+inline PrimeSummary summarizeRange(BS::thread_pool &pool, uint64_t low, uint64_t high, const SieveConfig &config){
+    return reduceRange(pool, low, high, config, summarizeSegment, mergeSummaries);
+}
+
+inline PrimeSummary summarizeRange(BS::thread_pool &pool, BasePrimeTable &basePrimes, uint64_t low, uint64_t high, const SieveConfig &config){
+    return reduceRange(pool, basePrimes, low, high, config, summarizeSegment, mergeSummaries);
+}
+
+// The summary of [low, reached]: the longest run of segments from low that were sieved before the token was
+// cancelled. complete is true if that is all of [low, high].
+struct PartialSummary {
+    PrimeSummary summary;
+    uint64_t reached = 0;
+    bool complete = false;
+};
+
+// Like summarizeRange, but each segment checks the token before it is sieved, so a cancellation or a deadline frees
+// the pool within about one segment per thread. The token is only checked at segment granularity: a segment that has
+// started runs to its end, so a deadline can be overrun by up to one segment's time. Segments are summarized as they
+// finish and merged in order at the end; those past the first skipped one are dropped, so that the partial result is
+// exact for a prefix of the range.
+// The base primes come from a table started with a limit of at least sqrt(high).
+inline PartialSummary summarizeUntil(BS::thread_pool &pool, BasePrimeTable &basePrimes, uint64_t low, uint64_t high, const SieveConfig &config,
+                                     const BS::cancel_token &token){
+    PartialSummary partial;
+    size_t segments = segmentCount(low, high, config);
+    partial.reached = low == 0 ? 0 : low - 1;
+    partial.complete = segments == 0;
+    if(segments == 0){ return partial; }
+    std::vector<std::optional<PrimeSummary>> parts = pool.submit_sequence<size_t>(0, segments, [&] (size_t index) {
+        return summarizeSegment(sieveSegmentAt(index, low, high, basePrimes, config));
+    }, token).get_partial();
+    const uint64_t span = segmentSpan(config);
+    for(size_t index = 0; index < parts.size() && parts[index].has_value(); index++){
+        partial.summary = mergeSummaries(partial.summary, *parts[index]);
+        uint64_t segmentLow = (low & ~1ULL) + index * span;
+        partial.reached = high - segmentLow < span ? high : segmentLow + span - 1;
+        partial.complete = index + 1 == segments;
+    }
+    return partial;
+}
+
+// With its own table, whose base segments check the token too.
+inline PartialSummary summarizeUntil(BS::thread_pool &pool, uint64_t low, uint64_t high, const SieveConfig &config, const BS::cancel_token &token){
+    BasePrimeTable basePrimes;
+    if(segmentCount(low, high, config) > 0){ basePrimes.start(pool, integerSqrt(high), config, token); }
+    return summarizeUntil(pool, basePrimes, low, high, config, token);
+}
+
+inline std::vector<uint64_t> listPrimes(BS::thread_pool &pool, uint64_t low, uint64_t high, const SieveConfig &config){
+    std::vector<uint64_t> primes;
+    auto segments = sieveRange(pool, low, high, config, [] (const SegmentView &segment) {
+        std::vector<uint64_t> found;
+        segment.forEachPrime([&] (uint64_t prime) { found.push_back(prime); });
+        return found;
+    });
+    for(std::vector<uint64_t> &segment : segments){ primes.insert(primes.end(), segment.begin(), segment.end()); }
+    return primes;
+}
+
+} // namespace segsieve
+
+#endif
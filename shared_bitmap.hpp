@@ -0,0 +1,175 @@
+#ifndef SHARED_BITMAP_HPP
+#define SHARED_BITMAP_HPP
+
+/**
+ * One contiguous packed bitmap of the odd numbers up to a limit, sieved in parallel with dynamic scheduling.
+ *
+ * The segmented engine gives every thread a private scratch buffer, so threads never touch the same memory. Here all
+ * threads write into one shared bitmap (bit i stands for 2i + 1), which is what a long-lived index wants, so segment
+ * ownership has to be arranged carefully:
+ *  - When a segment spans a whole number of cache lines (1024 numbers per 64-byte line), each segment owns its
+ *    lines outright and is sieved in place with plain stores: no races and no false sharing.
+ *  - Otherwise neighbouring segments share a word at each boundary. Such segments are sieved into the thread's
+ *    scratch buffer, interior words are stored plainly, and only the two boundary words are merged with an atomic
+ *    fetch_and into the bitmap, which starts out as all ones.
+ *
+ * Workers pull segment numbers from one atomic counter, so a slow segment does not hold up a whole static chunk, and
+ * their per-thread tallies live in cache-line padded slots so that updating them does not false-share either.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+#include "BS_thread_pool.hpp"
+#include "segmented_sieve.hpp"
+
+namespace sharedbitmap {
+
+const uint64_t NUMBERS_PER_LINE = 64 * 8 * 2;  // one 64-byte cache line of odd-only bits
+
+struct alignas(64) WorkerSlot {
+    uint64_t segments = 0;
+    uint64_t atomicMerges = 0;
+    uint64_t count = 0;
+    segsieve::PrimeSum sum = 0;
+};
+
+class SharedBitmap {
+public:
+    // Sieves every number in [0, limit]. With config.segmentBytes a multiple of 64 the segments are cache-line aligned.
+    void build(BS::thread_pool &pool, uint64_t newLimit, const segsieve::SieveConfig &config){
+        limitValue = newLimit;
+        bitCount = (size_t)((newLimit + 1) / 2);
+        wordCount = (bitCount + 63) / 64;
+        words.reset(static_cast<uint64_t*>(::operator new(std::max<size_t>(wordCount, 1) * sizeof(uint64_t), std::align_val_t(64))));
+        uint64_t span = segsieve::segmentSpan(config);
+        lineAligned = span % NUMBERS_PER_LINE == 0;
+        size_t segments = (size_t)(newLimit / span + 1);
+        std::vector<uint32_t> basePrimes = segsieve::simpleSieve(segsieve::integerSqrt(newLimit));
+        const segsieve::WheelPattern &wheel = segsieve::wheelPattern(config.wheel);
+        slots.assign(pool.get_thread_count(), WorkerSlot());
+
+        if(!lineAligned){
+            pool.submit_blocks<size_t>(0, wordCount, [this] (size_t first, size_t last) {
+                std::fill(words.get() + first, words.get() + last, ~0ULL);
+            }).wait();
+        }
+
+        std::atomic<size_t> nextSegment{0};
+        pool.submit_sequence<unsigned>(0, pool.get_thread_count(), [&] (unsigned) {
+            WorkerSlot &slot = slots[BS::this_thread::get_index().value_or(0)];
+            for(size_t segment = nextSegment.fetch_add(1); segment < segments; segment = nextSegment.fetch_add(1)){
+                uint64_t segmentLow = segment * span;
+                uint64_t segmentHigh = std::min(newLimit, segmentLow + span - 1);
+                if(lineAligned){
+                    sieveInPlace(segmentLow, segmentHigh, basePrimes, wheel);
+                } else {
+                    slot.atomicMerges += sieveAndMerge(segmentLow, segmentHigh, basePrimes, wheel, span);
+                }
+                slot.segments++;
+            }
+        }).wait();
+
+        if(bitCount % 64 != 0){ words[wordCount - 1] &= (1ULL << (bitCount % 64)) - 1; }  // bits past the limit
+        if(wordCount > 0){ words[0] &= ~1ULL; }  // 1 is not prime
+    }
+
+    uint64_t limit() const { return limitValue; }
+    const uint64_t* data() const { return words.get(); }  // bit i of the packed words stands for 2i + 1
+    bool cacheLineAligned() const { return lineAligned; }
+    const std::vector<WorkerSlot>& workerSlots() const { return slots; }
+
+    bool isPrime(uint64_t n) const {
+        if(n > limitValue || n < 2){ return false; }
+        if(n % 2 == 0){ return n == 2; }
+        uint64_t bit = n / 2;
+        return (words[bit / 64] >> (bit % 64)) & 1;
+    }
+
+    // A view of the numbers in [low, high], widened to whole words, for the usual per-segment extractors.
+    segsieve::SegmentView view(uint64_t low, uint64_t high) const {
+        high = std::min(high, limitValue);
+        size_t firstWord = (size_t)(low / 128);
+        size_t lastWord = (size_t)(high / 128);
+        uint64_t viewLow = firstWord * 128;
+        size_t bits = std::min<size_t>((lastWord - firstWord + 1) * 64, bitCount - firstWord * 64);
+        return {words.get() + firstWord, bits, viewLow, high, viewLow <= 2 && high >= 2};
+    }
+
+    // Count, sum and largest primes, one cache-line aligned slice per task, tallied in the padded worker slots.
+    segsieve::PrimeSummary summarize(BS::thread_pool &pool) const {
+        std::vector<WorkerSlot> tallies(pool.get_thread_count());
+        uint64_t sliceNumbers = 1 << 20;
+        size_t slices = (size_t)(limitValue / sliceNumbers + 1);
+        pool.submit_sequence<size_t>(0, slices, [&] (size_t slice) {
+            WorkerSlot &tally = tallies[BS::this_thread::get_index().value_or(0)];
+            segsieve::SegmentView part = view(slice * sliceNumbers, std::min(limitValue, (slice + 1) * sliceNumbers - 1));
+            tally.count += part.countPrimes();
+            part.forEachPrime([&] (uint64_t prime) { tally.sum += prime; });
+        }).wait();
+
+        segsieve::PrimeSummary summary;
+        for(WorkerSlot &tally : tallies){
+            summary.count += tally.count;
+            summary.sum += tally.sum;
+        }
+        for(uint64_t n = limitValue; n >= 2 && summary.largest.size() < segsieve::TOP_PRIMES; n--){
+            if(isPrime(n)){ summary.largest.push_back(n); }
+        }
+        std::reverse(summary.largest.begin(), summary.largest.end());
+        return summary;
+    }
+
+private:
+    struct AlignedDelete {
+        void operator()(uint64_t* pointer) const { ::operator delete(pointer, std::align_val_t(64)); }
+    };
+
+    // The segment starts on a word boundary and owns all of its words, so the kernel writes straight into the bitmap.
+    void sieveInPlace(uint64_t low, uint64_t high, const std::vector<uint32_t> &basePrimes, const segsieve::WheelPattern &wheel){
+        segsieve::sieveSegment(words.get() + low / 128, low, high, basePrimes, wheel);
+    }
+
+    // Sieves into scratch, then shifts the result into place. Returns how many words needed an atomic merge.
+    int sieveAndMerge(uint64_t low, uint64_t high, const std::vector<uint32_t> &basePrimes, const segsieve::WheelPattern &wheel, uint64_t span){
+        size_t segmentBits = (size_t)((high - low + 1) / 2);
+        if(segmentBits == 0){ return 0; }
+        uint64_t* scratch = segsieve::segmentBuffer(span / 128 + 2);
+        segsieve::sieveSegment(scratch, low, high, basePrimes, wheel);
+
+        size_t firstBit = (size_t)(low / 2);
+        size_t lastBit = firstBit + segmentBits - 1;
+        size_t firstWord = firstBit / 64, lastWord = lastBit / 64;
+        unsigned shift = firstBit % 64;
+        int merges = 0;
+        for(size_t word = firstWord; word <= lastWord; word++){
+            size_t j = word - firstWord;  // scratch word that supplies the high bits of this word
+            uint64_t value = shift == 0 ? scratch[j] : (scratch[j] << shift) | (j > 0 ? scratch[j - 1] >> (64 - shift) : 0);
+            uint64_t mask = ~0ULL;  // which bits of this word belong to the segment
+            if(word == firstWord){ mask &= ~0ULL << shift; }
+            if(word == lastWord && lastBit % 64 != 63){ mask &= (1ULL << (lastBit % 64 + 1)) - 1; }
+            if(mask == ~0ULL){
+                words[word] = value;
+            } else {
+                __atomic_fetch_and(&words[word], value | ~mask, __ATOMIC_RELAXED);
+                merges++;
+            }
+        }
+        return merges;
+    }
+
+    std::unique_ptr<uint64_t[], AlignedDelete> words;
+    uint64_t limitValue = 0;
+    size_t bitCount = 0;
+    size_t wordCount = 0;
+    bool lineAligned = true;
+    std::vector<WorkerSlot> slots;
+};
+
+} // namespace sharedbitmap
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef SIEVE_ANALYSIS_HPP
+#define SIEVE_ANALYSIS_HPP
+
+/**
+ * Statistics about the primes that the segmented engine gathers in the same pass as the count and sum.
+ *
+ * Every statistic is computed from a segment's bitmap right after the segment is sieved, and merged with the
+ * neighbouring segments' results in the pool's reduction tree, so nothing beyond the per-segment results is ever
+ * materialised. Which statistics are gathered is chosen with AnalysisOptions; the report lines go under the top ten
+ * in primes.txt.
+ */
+
+#include <string>
+#include <vector>
+#include "BS_thread_pool.hpp"
+#include "prime_gaps.hpp"
+#include "prime_residues.hpp"
+#include "prime_tuplets.hpp"
+#include "segmented_sieve.hpp"
+
+namespace sieveanalysis {
+
+struct AnalysisOptions {
+    bool tuplets = false;
+    bool gaps = false;
+    uint64_t residueModulus = 0;  // count and sum the primes in every residue class mod this, if not 0
+
+    bool any() const { return tuplets || gaps || residueModulus > 0; }
+};
+
+struct RangeReport {
+    segsieve::PrimeSummary summary;
+    primetuplets::TupletCounts tuplets;
+    primegaps::GapStats gaps;
+    primeresidues::ResidueTable residues;
+};
+
+// The report of one segment. Its residues go to the run's accumulator rather than into the report, whose residue
+// table stays empty until collect().
+inline RangeReport analyzeSegment(const segsieve::SegmentView &segment, const AnalysisOptions &options, primeresidues::ResidueAccumulator &residues){
+    RangeReport report;
+    report.summary = segsieve::summarizeSegment(segment);
+    if(options.tuplets){ report.tuplets = primetuplets::countSegment(segment); }
+    if(options.gaps){ report.gaps = primegaps::gapSegment(segment); }
+    if(options.residueModulus > 0){ residues.add(segment); }
+    return report;
+}
+
+// Combines the report of a range with the report of the range right after it. left is taken by value so that the
+// reduction tree moves it in.
+inline RangeReport mergeReports(RangeReport left, const RangeReport &right){
+    left.summary = segsieve::mergeSummaries(left.summary, right.summary);
+    left.tuplets = primetuplets::mergeTuplets(left.tuplets, right.tuplets);
+    left.gaps = primegaps::mergeGaps(left.gaps, right.gaps);
+    left.residues = primeresidues::mergeResidues(std::move(left.residues), right.residues);
+    return left;
+}
+
+inline RangeReport analyzeRange(BS::thread_pool &pool, uint64_t low, uint64_t high, const segsieve::SieveConfig &config, const AnalysisOptions &options){
+    primeresidues::ResidueAccumulator residues(pool.get_thread_count(), options.residueModulus);
+    RangeReport report = segsieve::reduceRange(pool, low, high, config, [&] (const segsieve::SegmentView &segment) {
+        return analyzeSegment(segment, options, residues);
+    }, mergeReports);
+    report.residues = residues.collect();
+    return report;
+}
+
+inline std::vector<std::string> reportLines(const RangeReport &report, const AnalysisOptions &options){
+    std::vector<std::string> lines;
+    if(options.tuplets){
+        for(size_t k = 0; k < primetuplets::PATTERN_COUNT; k++){
+            lines.push_back(std::string(primetuplets::PATTERNS[k].name) + ": " + std::to_string(report.tuplets.counts[k]));
+        }
+    }
+    if(options.gaps && !report.gaps.records.empty()){
+        const primegaps::Gap &longest = report.gaps.records.back();
+        lines.push_back("Maximal gap: " + std::to_string(longest.length) + " after " + std::to_string(longest.prime));
+        std::string records = "Record gaps (length after prime):";
+        for(const primegaps::Gap &gap : report.gaps.records){ records += " " + std::to_string(gap.length) + "@" + std::to_string(gap.prime); }
+        lines.push_back(records);
+        std::string histogram = "Gap histogram (length:count):";
+        for(size_t g = 0; g < report.gaps.histogram.size(); g++){
+            if(report.gaps.histogram[g] > 0){ histogram += " " + std::to_string(g) + ":" + std::to_string(report.gaps.histogram[g]); }
+        }
+        lines.push_back(histogram);
+    }
+    if(options.residueModulus > 0){
+        lines.push_back("Primes by residue mod " + std::to_string(options.residueModulus) + " (residue: count, sum):");
+        for(uint64_t a = 0; a < report.residues.modulus; a++){
+            if(report.residues.counts[a] == 0){ continue; }
+            lines.push_back(std::to_string(a) + ": " + std::to_string(report.residues.counts[a]) + ", "
+                            + segsieve::sumToString(report.residues.sums[a]));
+        }
+    }
+    return lines;
+}
+
+} // namespace sieveanalysis
+
+#endif
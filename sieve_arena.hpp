@@ -0,0 +1,182 @@
+#ifndef SIEVE_ARENA_HPP
+#define SIEVE_ARENA_HPP
+
+/**
+ * A bump-pointer arena for the sieve's bit chunks, segment buffers and prime lists.
+ *
+ * The arena maps one large region up front, preferably backed by hugepages (MAP_HUGETLB, otherwise transparent
+ * hugepages through madvise), and touches every page of it in parallel on the thread pool before the timed part of
+ * a run starts. Allocations are cache-line aligned by default and are never freed one by one: prepare() forgets all
+ * of them at once and keeps the pages, so repeated runs in the same process reuse memory that is already faulted in
+ * and already covered by a handful of TLB entries.
+ *
+ * Allocator<T> plugs the arena into std::vector. If the arena runs out, it falls back to the normal heap, so an
+ * undersized estimate costs speed but never correctness.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include "BS_thread_pool.hpp"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace sievearena {
+
+const size_t CACHE_LINE = 64;
+const size_t PAGE_SIZE = 4096;
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+inline size_t roundUp(size_t value, size_t multiple){
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+class Arena {
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena(){ release(); }
+
+    // Makes sure at least bytes are mapped and pre-faulted, and forgets every earlier allocation.
+    // Only call this between runs, when nothing allocated from the arena is still in use.
+    void prepare(size_t bytes, BS::thread_pool &pool){
+        if(bytes > size){
+            release();
+            map(roundUp(bytes, HUGE_PAGE_SIZE));
+            prefault(pool);
+        }
+        offset.store(0);
+        generation.fetch_add(1);
+    }
+
+    // Returns nullptr when the arena is full; callers fall back to the heap.
+    void* allocate(size_t bytes, size_t alignment = CACHE_LINE){
+        size_t current = offset.load(std::memory_order_relaxed);
+        while(true){
+            size_t start = roundUp(current, alignment);
+            if(base == nullptr || start + bytes > size){ return nullptr; }
+            if(offset.compare_exchange_weak(current, start + bytes, std::memory_order_relaxed)){
+                return base + start;
+            }
+        }
+    }
+
+    bool owns(const void* pointer) const {
+        const char* p = static_cast<const char*>(pointer);
+        return base != nullptr && p >= base && p < base + size;
+    }
+
+    size_t capacity() const { return size; }
+    size_t used() const { return offset.load(); }
+    const std::string& backing() const { return backingKind; }
+
+    // Bumped by every prepare(), so long-lived per-thread buffers can tell that their memory was handed out again.
+    uint64_t currentGeneration() const { return generation.load(); }
+
+private:
+    void map(size_t bytes){
+#ifdef __linux__
+        void* region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(region != MAP_FAILED){
+            backingKind = "hugetlbfs pages (MAP_HUGETLB)";
+        } else {
+            region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(region == MAP_FAILED){ throw std::bad_alloc(); }
+            backingKind = madvise(region, bytes, MADV_HUGEPAGE) == 0 ? "transparent hugepages (madvise)" : "4 KiB pages";
+        }
+        mapped = true;
+#else
+        void* region = ::operator new(bytes, std::align_val_t(HUGE_PAGE_SIZE));
+        backingKind = "heap (aligned)";
+        mapped = false;
+#endif
+        base = static_cast<char*>(region);
+        size = bytes;
+    }
+
+    // One write per page, split across the pool, so the page faults happen here and not inside the timed sieve.
+    void prefault(BS::thread_pool &pool){
+        size_t pages = size / PAGE_SIZE;
+        pool.submit_blocks<size_t>(0, pages, [this] (size_t first, size_t last) {
+            for(size_t page = first; page < last; page++){
+                static_cast<volatile char*>(base)[page * PAGE_SIZE] = 0;
+            }
+        }).wait();
+    }
+
+    void release(){
+        if(base == nullptr){ return; }
+#ifdef __linux__
+        if(mapped){ munmap(base, size); }
+#else
+        ::operator delete(base, std::align_val_t(HUGE_PAGE_SIZE));
+#endif
+        base = nullptr;
+        size = 0;
+    }
+
+    char* base = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+    std::atomic<size_t> offset{0};
+    std::atomic<uint64_t> generation{0};
+    std::string backingKind = "none";
+};
+
+inline Arena& arena(){
+    static Arena instance;
+    return instance;
+}
+
+// std::allocator replacement that draws from the global arena. Deallocation is a no-op for arena memory.
+template <typename T>
+struct Allocator {
+    using value_type = T;
+
+    Allocator() = default;
+    template <typename U>
+    Allocator(const Allocator<U>&) {}
+
+    T* allocate(size_t count){
+        void* memory = arena().allocate(count * sizeof(T), std::max(alignof(T), CACHE_LINE));
+        return static_cast<T*>(memory != nullptr ? memory : ::operator new(count * sizeof(T)));
+    }
+
+    void deallocate(T* pointer, size_t){
+        if(!arena().owns(pointer)){ ::operator delete(pointer); }
+    }
+
+    template <typename U>
+    bool operator==(const Allocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const Allocator<U>&) const { return false; }
+};
+
+// A page-aligned buffer that lives for the whole thread but is re-drawn from the arena after every prepare().
+template <typename T>
+T* threadBuffer(size_t count){
+    thread_local T* buffer = nullptr;
+    thread_local size_t capacity = 0;
+    thread_local uint64_t generation = 0;
+    thread_local bool fromHeap = false;
+    if(buffer != nullptr && capacity >= count && (fromHeap || generation == arena().currentGeneration())){ return buffer; }
+    if(fromHeap){ ::operator delete(buffer, std::align_val_t(PAGE_SIZE)); }
+    size_t bytes = roundUp(count * sizeof(T), PAGE_SIZE);
+    void* memory = arena().allocate(bytes, PAGE_SIZE);
+    fromHeap = memory == nullptr;
+    if(fromHeap){ memory = ::operator new(bytes, std::align_val_t(PAGE_SIZE)); }
+    buffer = static_cast<T*>(memory);
+    capacity = bytes / sizeof(T);
+    generation = arena().currentGeneration();
+    return buffer;
+}
+
+} // namespace sievearena
+
+#endif
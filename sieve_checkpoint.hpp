@@ -0,0 +1,219 @@
+#ifndef SIEVE_CHECKPOINT_HPP
+#define SIEVE_CHECKPOINT_HPP
+
+/**
+ * Periodic checkpoints for long segmented sieves, so a crashed or preempted run can pick up where it stopped.
+ *
+ * The range is sieved in batches of whole segments (segsieve::forEachBatch). After every batch the running totals
+ * cover exactly [low, batchHigh], which is what a checkpoint records: the range and segment size of the run, the
+ * first number not yet sieved, and the count, sum and largest primes so far. At most once per interval the sieving
+ * thread hands the latest checkpoint to a writer thread and carries on; the writer writes it to a temporary file and
+ * renames it over the old one, so a crash in the middle of a write leaves the previous checkpoint intact.
+ *
+ * Resuming reads the file, checks that it belongs to the same range and segment size, and continues with the batch
+ * after the last one it covers. Batches start on multiples of the segment span from low, so the resumed run sieves
+ * exactly the segments the original run would have.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BS_thread_pool.hpp"
+#include "segmented_sieve.hpp"
+
+namespace sievecheckpoint {
+
+const size_t BATCH_SEGMENTS = 1024;  // segments per batch, i.e. the granularity of a checkpoint
+
+struct Checkpoint {
+    uint64_t low = 0;
+    uint64_t high = 0;
+    uint64_t segmentBytes = 0;
+    uint64_t next = 0;                // every number below next (and from low) has been sieved
+    segsieve::PrimeSummary summary;   // of [low, next - 1]
+};
+
+inline void writeCheckpoint(std::ostream &out, const Checkpoint &checkpoint){
+    out << "# checkpoint of ./main.exe --engine segmented; continue with --resume" << std::endl;
+    out << "low=" << checkpoint.low << std::endl;
+    out << "high=" << checkpoint.high << std::endl;
+    out << "segment_bytes=" << checkpoint.segmentBytes << std::endl;
+    out << "next=" << checkpoint.next << std::endl;
+    out << "count=" << checkpoint.summary.count << std::endl;
+    out << "sum=" << segsieve::sumToString(checkpoint.summary.sum) << std::endl;
+    out << "largest=";
+    for(size_t i = 0; i < checkpoint.summary.largest.size(); i++){ out << (i > 0 ? " " : "") << checkpoint.summary.largest[i]; }
+    out << std::endl;
+}
+
+// Returns false if the file is incomplete or does not parse.
+inline bool readCheckpoint(std::istream &in, Checkpoint &checkpoint){
+    std::string line;
+    int required = 0;
+    try {
+        while(std::getline(in, line)){
+            if(line.empty() || line[0] == '#'){ continue; }
+            size_t equals = line.find('=');
+            if(equals == std::string::npos){ continue; }
+            std::string key = line.substr(0, equals), value = line.substr(equals + 1);
+            if(key == "largest"){
+                std::istringstream values(value);
+                checkpoint.summary.largest.clear();
+                for(uint64_t prime; values >> prime;){ checkpoint.summary.largest.push_back(prime); }
+                required++;
+            }
+            else if(key == "low"){ checkpoint.low = std::stoull(value); required++; }
+            else if(key == "high"){ checkpoint.high = std::stoull(value); required++; }
+            else if(key == "segment_bytes"){ checkpoint.segmentBytes = std::stoull(value); required++; }
+            else if(key == "next"){ checkpoint.next = std::stoull(value); required++; }
+            else if(key == "count"){ checkpoint.summary.count = std::stoull(value); required++; }
+            else if(key == "sum"){
+                if(!segsieve::parseSum(value, checkpoint.summary.sum)){ return false; }
+                required++;
+            }
+        }
+    } catch(const std::exception&){
+        return false;
+    }
+    return required == 7;
+}
+
+// Writes to path.tmp and renames it over path, so that the file at path is always a complete checkpoint.
+inline bool saveCheckpoint(const std::string &path, const Checkpoint &checkpoint){
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary);
+        writeCheckpoint(file, checkpoint);
+        file.flush();
+        if(!file){ return false; }
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+// A thread that writes the latest offered checkpoint in the background. Offers that arrive while a write is still
+// in progress replace each other; only the newest one is written.
+class CheckpointWriter {
+public:
+    CheckpointWriter(std::string path, double intervalSeconds)
+        : path(std::move(path)), interval(intervalSeconds), lastOffer(std::chrono::steady_clock::now()), thread([this] { run(); }) {}
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+    ~CheckpointWriter(){ stop(); }
+
+    // Called by the sieving thread after every batch; cheap unless the interval has passed.
+    void offer(const Checkpoint &checkpoint){
+        auto now = std::chrono::steady_clock::now();
+        if(std::chrono::duration<double>(now - lastOffer).count() < interval){ return; }
+        lastOffer = now;
+        const std::scoped_lock lock(mutex);
+        pending = checkpoint;
+        hasPending = true;
+        wakeup.notify_one();
+    }
+
+    // Stops the writer thread and writes the final checkpoint in the calling thread.
+    bool finish(const Checkpoint &checkpoint){
+        stop();
+        written++;
+        return saveCheckpoint(path, checkpoint) && failures == 0;
+    }
+
+    int checkpointsWritten() const { return written; }
+
+private:
+    void run(){
+        std::unique_lock lock(mutex);
+        while(true){
+            wakeup.wait(lock, [this] { return hasPending || stopping; });
+            if(!hasPending){ return; }
+            Checkpoint checkpoint = pending;
+            hasPending = false;
+            lock.unlock();
+            bool saved = saveCheckpoint(path, checkpoint);
+            lock.lock();
+            written++;
+            if(!saved){ failures++; }
+        }
+    }
+
+    void stop(){
+        {
+            const std::scoped_lock lock(mutex);
+            stopping = true;
+            wakeup.notify_one();
+        }
+        if(thread.joinable()){ thread.join(); }
+    }
+
+    std::string path;
+    double interval;
+    std::chrono::steady_clock::time_point lastOffer;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    Checkpoint pending;
+    bool hasPending = false;
+    bool stopping = false;
+    int written = 0;
+    int failures = 0;
+    std::thread thread;  // last, so that it starts after everything it uses is constructed
+};
+
+// Whether a checkpoint's next is where one of its run's batches starts, or one past its high end once it is done.
+inline bool onBatchBoundary(const Checkpoint &checkpoint, const segsieve::SieveConfig &config){
+    uint64_t batchSpan = segsieve::segmentSpan(config) * BATCH_SEGMENTS;
+    if(checkpoint.next < checkpoint.low){ return false; }
+    return checkpoint.next - 1 == checkpoint.high || (checkpoint.next <= checkpoint.high && (checkpoint.next - checkpoint.low) % batchSpan == 0);
+}
+
+// summarizeRange with checkpoints to path every intervalSeconds. With resume, continues from the checkpoint at path
+// if it belongs to the same range and segment size; otherwise starts from low and says why on log.
+inline segsieve::PrimeSummary summarizeRange(BS::thread_pool &pool, uint64_t low, uint64_t high, const segsieve::SieveConfig &config,
+                                             const std::string &path, double intervalSeconds, bool resume, std::ostream &log){
+    Checkpoint state;
+    state.low = low & ~1ULL;
+    state.high = high;
+    state.segmentBytes = config.segmentBytes;
+    state.next = state.low;
+    if(resume){
+        std::ifstream file(path);
+        Checkpoint saved;
+        if(!file){
+            log << "no checkpoint at " << path << ", starting from " << state.low << std::endl;
+        } else if(!readCheckpoint(file, saved)){
+            log << "checkpoint " << path << " is incomplete, starting from " << state.low << std::endl;
+        } else if(saved.low != state.low || saved.high != high || saved.segmentBytes != config.segmentBytes){
+            log << "checkpoint " << path << " is for [" << saved.low << ", " << saved.high << "] with " << saved.segmentBytes
+                << " B segments, starting from " << state.low << std::endl;
+        } else if(!onBatchBoundary(saved, config)){
+            log << "checkpoint " << path << " continues from " << saved.next << ", which is neither the start of a batch of "
+                << BATCH_SEGMENTS << " segments nor the end of the range, starting from " << state.low << std::endl;
+        } else {
+            state = saved;
+            log << "resuming from " << state.next << " with " << state.summary.count << " primes so far" << std::endl;
+        }
+    }
+
+    CheckpointWriter writer(path, intervalSeconds);
+    if(state.next <= high){
+        segsieve::BasePrimeTable basePrimes;  // one for every batch that is left
+        basePrimes.start(pool, segsieve::integerSqrt(high), config);
+        segsieve::forEachBatch(state.next, high, config, BATCH_SEGMENTS, [&] (uint64_t batchLow, uint64_t batchHigh) {
+            state.summary = segsieve::mergeSummaries(state.summary, segsieve::summarizeRange(pool, basePrimes, batchLow, batchHigh, config));
+            state.next = batchHigh + 1;
+            writer.offer(state);
+        });
+    }
+    if(!writer.finish(state)){ log << "could not write checkpoint " << path << std::endl; }
+    return state.summary;
+}
+
+} // namespace sievecheckpoint
+
+#endif
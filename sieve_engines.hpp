@@ -0,0 +1,239 @@
+#ifndef SIEVE_ENGINES_HPP
+#define SIEVE_ENGINES_HPP
+
+/**
+ * Interchangeable sieve algorithms behind one interface: a segment [low, high] goes in, and the segment's bitmap
+ * comes out in the layout the rest of the program reads (odd numbers only, bit i = low + 2i + 1, see SegmentView).
+ * The driver below lays segments over a range, sieves them on the pool with whichever engine was picked, and hands
+ * each SegmentView to the same extract/merge functions the segmented engine uses, so aggregates come out the same.
+ *
+ *  - eratosthenes: the segmented sieve with a wheel (segmented_sieve.hpp), base primes sieved once in prepare().
+ *  - atkin: a segmented sieve of Atkin. Each segment toggles the odd numbers in its range that are solutions of
+ *    4x^2 + y^2 (n = 1, 5 mod 12), 3x^2 + y^2 (n = 7 mod 12) and 3x^2 - y^2 with x > y (n = 11 mod 12); for every x
+ *    the range of y that lands in the segment comes from two square roots. The numbers left with an odd number of
+ *    solutions are prime once the multiples of the squares of the base primes are cleared. The per-segment cost has
+ *    a term in sqrt(high) for the walk over x, which the sieve of Eratosthenes does not have.
+ *  - linear: Euler's linear sieve, which crosses off every composite exactly once, as its smallest prime factor times
+ *    a cofactor whose own smallest factor is no smaller. That condition needs the cofactor's factorisation, which a
+ *    segment far from 0 does not have, so the sieve runs sequentially over all of [0, limit] in prepare() and the
+ *    segments are copied out of its bitmap. It is here for comparison: O(limit) time with one division per crossing,
+ *    and limit / 16 bytes of bitmap plus the primes up to limit / 3.
+ *
+ * prepare() is called once per run, before any segment; sieve() may then be called from several threads at once.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "sieve_profiler.hpp"  // first: it configures BS_thread_pool.hpp
+#include "BS_thread_pool.hpp"
+#include "perf_counters.hpp"
+#include "segmented_sieve.hpp"
+
+namespace sieveengines {
+
+const char* const ENGINE_NAMES[] = {"eratosthenes", "atkin", "linear"};
+const uint64_t LINEAR_MAX_LIMIT = 4000000000;  // the primes it keeps are 32-bit, and its bitmap covers the whole range
+
+class SegmentEngine {
+public:
+    virtual ~SegmentEngine() = default;
+
+    virtual const char* name() const = 0;
+    virtual uint64_t maxLimit() const = 0;
+
+    // Sets up whatever the segments up to limit share, such as the base primes.
+    virtual void prepare(uint64_t limit) = 0;
+
+    // Writes the bitmap of [low, high] (low even, high at most the prepared limit) to words.
+    virtual void sieve(uint64_t* words, uint64_t low, uint64_t high) const = 0;
+
+    // Bytes held between segments, i.e. besides the per-thread segment buffers.
+    virtual size_t stateBytes() const = 0;
+};
+
+inline void toggle(uint64_t* words, uint64_t low, uint64_t n){
+    uint64_t bit = (n - low) >> 1;
+    words[bit >> 6] ^= 1ULL << (bit & 63);
+}
+
+inline uint64_t ceilSqrt(uint64_t n){
+    uint64_t root = segsieve::integerSqrt(n);
+    return root * root < n ? root + 1 : root;
+}
+
+class EratosthenesEngine : public SegmentEngine {
+public:
+    explicit EratosthenesEngine(const segsieve::SieveConfig &config) : wheel(segsieve::wheelPattern(config.wheel)) {}
+
+    const char* name() const override { return "eratosthenes"; }
+    uint64_t maxLimit() const override { return UINT64_MAX - 1; }
+    void prepare(uint64_t limit) override { basePrimes = segsieve::simpleSieve(segsieve::integerSqrt(limit)); }
+    void sieve(uint64_t* words, uint64_t low, uint64_t high) const override {
+        segsieve::sieveSegment(words, low, high, basePrimes, wheel);
+    }
+    size_t stateBytes() const override { return basePrimes.size() * sizeof(uint32_t); }
+
+private:
+    const segsieve::WheelPattern &wheel;
+    std::vector<uint32_t> basePrimes;
+};
+
+class AtkinEngine : public SegmentEngine {
+public:
+    const char* name() const override { return "atkin"; }
+    uint64_t maxLimit() const override { return 1ULL << 62; }  // keeps 4x^2 + y^2 below 2^64
+    void prepare(uint64_t limit) override { basePrimes = segsieve::simpleSieve(segsieve::integerSqrt(limit)); }
+    size_t stateBytes() const override { return basePrimes.size() * sizeof(uint32_t); }
+
+    void sieve(uint64_t* words, uint64_t low, uint64_t high) const override {
+        size_t bitCount = (size_t)((high - low + 1) / 2);
+        std::memset(words, 0, (bitCount + 63) / 64 * sizeof(uint64_t));
+
+        // n = 4x^2 + y^2 is odd only for odd y.
+        for(uint64_t x = 1; 4 * x * x + 1 <= high; x++){
+            uint64_t base = 4 * x * x;
+            uint64_t y = base >= low ? 1 : ceilSqrt(low - base) | 1;
+            for(uint64_t n = base + y * y; n <= high; y += 2, n = base + y * y){
+                uint64_t r = n % 12;
+                if(r == 1 || r == 5){ toggle(words, low, n); }
+            }
+        }
+        // n = 3x^2 + y^2 is odd when x and y have different parities.
+        for(uint64_t x = 1; 3 * x * x + 1 <= high; x++){
+            uint64_t base = 3 * x * x;
+            uint64_t y = base >= low ? 1 : ceilSqrt(low - base);
+            if(y % 2 == x % 2){ y++; }
+            for(uint64_t n = base + y * y; n <= high; y += 2, n = base + y * y){
+                if(n % 12 == 7){ toggle(words, low, n); }
+            }
+        }
+        // n = 3x^2 - y^2 with x > y, also odd for different parities; the smallest n for a given x is at y = x - 1.
+        for(uint64_t x = 2; 2 * x * x + 2 * x - 1 <= high; x++){
+            uint64_t base = 3 * x * x;
+            if(base <= low){ continue; }
+            uint64_t y = base > high ? ceilSqrt(base - high) : 1;
+            if(y % 2 == x % 2){ y++; }
+            uint64_t last = std::min(x - 1, segsieve::integerSqrt(base - low));
+            for(; y <= last; y += 2){
+                if((base - y * y) % 12 == 11){ toggle(words, low, base - y * y); }
+            }
+        }
+
+        // Non-squarefree numbers can have an odd number of solutions too.
+        for(uint32_t prime : basePrimes){
+            if(prime < 5){ continue; }
+            uint64_t square = (uint64_t)prime * prime;
+            if(square > high){ break; }
+            uint64_t multiple = (low + square - 1) / square * square;
+            if(multiple % 2 == 0){ multiple += square; }
+            for(; multiple <= high; multiple += 2 * square){
+                uint64_t bit = (multiple - low) >> 1;
+                words[bit >> 6] &= ~(1ULL << (bit & 63));
+            }
+        }
+        if(low <= 3 && high >= 3){ toggle(words, low, 3); }  // 3 solves none of the forms
+    }
+
+private:
+    std::vector<uint32_t> basePrimes;
+};
+
+class LinearEngine : public SegmentEngine {
+public:
+    const char* name() const override { return "linear"; }
+    uint64_t maxLimit() const override { return LINEAR_MAX_LIMIT; }
+    size_t stateBytes() const override { return bits.size() * sizeof(uint64_t) + primes.capacity() * sizeof(uint32_t); }
+
+    void prepare(uint64_t limit) override {
+        bits.assign(limit / 128 + 1, 0);  // composite odd numbers first, inverted at the end
+        primes.clear();
+        for(uint64_t i = 3; i <= limit; i += 2){
+            if(!(bits[i >> 7] >> ((i >> 1) & 63) & 1) && i <= limit / 3){ primes.push_back((uint32_t)i); }
+            for(uint32_t prime : primes){
+                uint64_t multiple = prime * i;
+                if(multiple > limit){ break; }
+                bits[multiple >> 7] |= 1ULL << ((multiple >> 1) & 63);
+                if(i % prime == 0){ break; }
+            }
+        }
+        for(uint64_t &word : bits){ word = ~word; }
+        bits[0] &= ~1ULL;  // 1 is not prime
+    }
+
+    void sieve(uint64_t* words, uint64_t low, uint64_t high) const override {
+        size_t bitCount = (size_t)((high - low + 1) / 2);
+        size_t first = (size_t)(low / 2), shift = first % 64;
+        const uint64_t* source = bits.data() + first / 64;
+        size_t wordCount = (bitCount + 63) / 64;
+        for(size_t w = 0; w < wordCount; w++){
+            uint64_t word = source[w] >> shift;
+            if(shift != 0 && first / 64 + w + 1 < bits.size()){ word |= source[w + 1] << (64 - shift); }
+            words[w] = word;
+        }
+        if(bitCount % 64 != 0){ words[wordCount - 1] &= (1ULL << (bitCount % 64)) - 1; }
+    }
+
+private:
+    std::vector<uint64_t> bits;     // bit i stands for 2i + 1
+    std::vector<uint32_t> primes;   // the odd primes up to limit / 3, the only ones that cross anything off
+};
+
+// The engine called name, or nullptr if there is none.
+inline std::unique_ptr<SegmentEngine> makeEngine(const std::string &name, const segsieve::SieveConfig &config){
+    if(name == "eratosthenes"){ return std::make_unique<EratosthenesEngine>(config); }
+    if(name == "atkin"){ return std::make_unique<AtkinEngine>(); }
+    if(name == "linear"){ return std::make_unique<LinearEngine>(); }
+    return nullptr;
+}
+
+// Sieves [low, high] with a prepared engine, segment by segment on the pool, and merges extract(segment) of the
+// segments in order with the pool's submit_reduce, like segsieve::reduceRange.
+template <typename Extract, typename Merge>
+std::invoke_result_t<Extract&, const segsieve::SegmentView&> reduceWith(BS::thread_pool &pool, const SegmentEngine &engine, uint64_t low, uint64_t high,
+                                                                        const segsieve::SieveConfig &config, Extract extract, Merge merge){
+    using Result = std::invoke_result_t<Extract&, const segsieve::SegmentView&>;
+    size_t segments = segsieve::segmentCount(low, high, config);
+    if(segments == 0){ return Result(); }
+    const uint64_t span = segsieve::segmentSpan(config);
+    return pool.submit_reduce<size_t>(0, segments, [&] (size_t index) {
+        uint64_t segmentLow = (low & ~1ULL) + index * span;
+        uint64_t segmentHigh = high - segmentLow < span ? high : segmentLow + span - 1;
+        size_t bitCount = (size_t)((segmentHigh - segmentLow + 1) / 2);
+        uint64_t* buffer = segsieve::segmentBuffer(span / 128 + 1);
+        if(bitCount > 0){
+            SIEVE_PROFILE_PHASE("sieveSegment");
+            perfcounters::ScopedCounters counters("sieveSegment");
+            engine.sieve(buffer, segmentLow, segmentHigh);
+        }
+        SIEVE_PROFILE_PHASE("extractSegment");
+        perfcounters::ScopedCounters counters("extractSegment");
+        return extract(segsieve::SegmentView{buffer, bitCount, segmentLow, segmentHigh, index == 0 && low <= 2 && high >= 2});
+    }, [&] (Result left, const Result &right) {
+        SIEVE_PROFILE_PHASE("mergeSegments");
+        perfcounters::ScopedCounters counters("mergeSegments");
+        return merge(std::move(left), right);
+    }).get();
+}
+
+inline segsieve::PrimeSummary summarizeWith(BS::thread_pool &pool, const SegmentEngine &engine, uint64_t low, uint64_t high, const segsieve::SieveConfig &config){
+    return reduceWith(pool, engine, low, high, config, segsieve::summarizeSegment, segsieve::mergeSummaries);
+}
+
+inline std::vector<uint64_t> listWith(BS::thread_pool &pool, const SegmentEngine &engine, uint64_t low, uint64_t high, const segsieve::SieveConfig &config){
+    return reduceWith(pool, engine, low, high, config, [] (const segsieve::SegmentView &segment) {
+        std::vector<uint64_t> primes;
+        segment.forEachPrime([&] (uint64_t prime) { primes.push_back(prime); });
+        return primes;
+    }, [] (std::vector<uint64_t> left, const std::vector<uint64_t> &right) {
+        left.insert(left.end(), right.begin(), right.end());
+        return left;
+    });
+}
+
+} // namespace sieveengines
+
+#endif
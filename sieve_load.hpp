@@ -0,0 +1,144 @@
+#ifndef SIEVE_LOAD_HPP
+#define SIEVE_LOAD_HPP
+
+/**
+ * A load generator for the sieve server: several client threads, each on its own connection, send batches of
+ * random requests and time every round trip.
+ *
+ * The mix is a third range counts (random ranges of up to RANGE_WIDTH numbers below rangeLimit, which the server
+ * answers from its index if it covers them), a third is-prime checks of random odd 64-bit numbers, and a sixth each
+ * of next-prime and prev-prime queries of random numbers below 2^62. The counts can carry a deadline. At the end it
+ * prints the throughput, the client-side p50 and p99 of the batch round trips, how many counts timed out, and the
+ * server's own per-request percentiles (a stats request).
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sieve_server.hpp"
+
+namespace sieveload {
+
+const uint64_t RANGE_WIDTH = 1000000;
+
+struct LoadOptions {
+    std::string path;
+    unsigned clients = 4;
+    size_t batches = 1000;       // per client
+    size_t batchSize = 16;
+    uint64_t rangeLimit = 100000000;
+    uint32_t deadlineMs = 0;     // on the range counts; 0 for none
+    uint64_t seed = 20240918;
+};
+
+// One connection; exchange() sends a batch and waits for its responses.
+class Client {
+public:
+    Client() = default;
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+    ~Client(){ sieveserver::closeSocket(fd); }
+
+    bool connect(const std::string &path, std::string &error){
+        fd = sieveserver::connectTo(path, error);
+        return fd >= 0;
+    }
+
+    bool exchange(const std::vector<sieveserver::Request> &requests, std::vector<sieveserver::Response> &responses){
+        uint32_t count = (uint32_t)requests.size(), received = 0;
+        if(!sieveserver::writeFully(fd, &count, sizeof(count)) || !sieveserver::writeFully(fd, requests.data(), count * sizeof(sieveserver::Request))
+           || !sieveserver::readFully(fd, &received, sizeof(received)) || received != count){
+            return false;
+        }
+        responses.resize(received);
+        return sieveserver::readFully(fd, responses.data(), received * sizeof(sieveserver::Response));
+    }
+
+private:
+    int fd = -1;
+};
+
+inline sieveserver::Request randomRequest(std::mt19937_64 &random, uint64_t rangeLimit, uint32_t deadlineMs = 0){
+    unsigned kind = random() % 6;
+    if(kind < 2){
+        uint64_t a = random() % (rangeLimit + 1);
+        uint64_t b = std::min(rangeLimit, a + random() % RANGE_WIDTH);
+        return {sieveserver::OP_COUNT, deadlineMs, a, b};
+    }
+    if(kind < 4){ return {sieveserver::OP_IS_PRIME, 0, random() | 1, 0}; }
+    return {kind == 4 ? sieveserver::OP_NEXT_PRIME : sieveserver::OP_PREV_PRIME, 0, random() >> 2, 0};
+}
+
+// Sends one request to the server at path, e.g. a shutdown. Returns false with a message on out if it fails.
+inline bool sendOne(const std::string &path, const sieveserver::Request &request, sieveserver::Response &response, std::ostream &out){
+    Client client;
+    std::string error;
+    std::vector<sieveserver::Response> responses;
+    if(!client.connect(path, error)){
+        out << error << std::endl;
+        return false;
+    }
+    if(!client.exchange({request}, responses)){
+        out << "no response from " << path << std::endl;
+        return false;
+    }
+    response = responses[0];
+    return true;
+}
+
+inline bool runLoad(const LoadOptions &options, std::ostream &out){
+    std::vector<std::vector<uint64_t>> roundTrips(options.clients);  // nanoseconds per batch
+    std::vector<std::string> errors(options.clients);
+    std::vector<size_t> timeouts(options.clients);
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for(unsigned c = 0; c < options.clients; c++){
+        clients.emplace_back([&, c] {
+            Client client;
+            if(!client.connect(options.path, errors[c])){ return; }
+            std::mt19937_64 random(options.seed + c);
+            std::vector<sieveserver::Request> requests(options.batchSize);
+            std::vector<sieveserver::Response> responses;
+            for(size_t batch = 0; batch < options.batches; batch++){
+                for(sieveserver::Request &request : requests){ request = randomRequest(random, options.rangeLimit, options.deadlineMs); }
+                auto sent = std::chrono::steady_clock::now();
+                if(!client.exchange(requests, responses)){
+                    errors[c] = "connection closed after " + std::to_string(batch) + " batches";
+                    return;
+                }
+                roundTrips[c].push_back((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sent).count());
+                for(const sieveserver::Response &response : responses){ timeouts[c] += response.status == sieveserver::STATUS_TIMEOUT; }
+            }
+        });
+    }
+    for(std::thread &client : clients){ client.join(); }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::vector<uint64_t> all;
+    size_t timedOut = 0;
+    for(unsigned c = 0; c < options.clients; c++){
+        if(!errors[c].empty()){ out << "client " << c << ": " << errors[c] << std::endl; }
+        all.insert(all.end(), roundTrips[c].begin(), roundTrips[c].end());
+        timedOut += timeouts[c];
+    }
+    size_t requests = all.size() * options.batchSize;
+    out << options.clients << " clients, " << all.size() << " batches of " << options.batchSize << ": " << requests << " requests in "
+        << seconds * 1000 << " ms, " << requests / seconds << " requests/s" << std::endl;
+    out << "round trip per batch: p50 " << sieveserver::percentile(all, 0.5) / 1000.0 << " us, p99 "
+        << sieveserver::percentile(all, 0.99) / 1000.0 << " us" << std::endl;
+    if(options.deadlineMs > 0){ out << timedOut << " counts passed their " << options.deadlineMs << " ms deadline and returned a partial count" << std::endl; }
+
+    sieveserver::Response stats;
+    if(!sendOne(options.path, {sieveserver::OP_STATS, 0, 0, 0}, stats, out)){ return false; }
+    out << "server, per request: " << stats.values[0] << " served, p50 " << stats.values[1] / 1000.0 << " us, p99 "
+        << stats.values[2] / 1000.0 << " us" << std::endl;
+    return all.size() == options.clients * options.batches;
+}
+
+} // namespace sieveload
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef SIEVE_PROFILER_HPP
+#define SIEVE_PROFILER_HPP
+
+/**
+ * Lightweight instrumentation for the sieve pipeline.
+ *
+ * Everything in this file is compiled out unless SIEVE_PROFILE is defined (see the "profile" target in the Makefile).
+ * When enabled it records:
+ *  - per-phase timers (wheel setup, base sieve, chunk sieve, extraction, ...),
+ *  - the duration of every task run by BS::thread_pool, plus per-worker busy and idle time,
+ *  - the depth of the pool's queue each time a worker takes a task,
+ *  - named counters, such as the number of bits crossed off by chunkSieve.
+ *
+ * The result can be printed as a summary table or written as a Chrome trace (chrome://tracing or https://ui.perfetto.dev).
+ */
+
+#ifdef SIEVE_PROFILE
+    #define BS_THREAD_POOL_ENABLE_PROFILING
+#endif
+#include "BS_thread_pool.hpp"
+
+#ifdef SIEVE_PROFILE
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace sieveprof {
+
+using Clock = std::chrono::steady_clock;
+
+// Thread id used in the trace for anything that is not a pool worker (normally the main thread).
+// Pool workers are shown as 1..N so they sort below it.
+inline unsigned currentTraceThread(){
+    BS::this_thread::optional_index index = BS::this_thread::get_index();
+    return index.has_value() ? static_cast<unsigned>(index.value()) + 1 : 0;
+}
+
+struct TraceEvent {
+    std::string name;
+    char phase;          // 'X' = complete event (span), 'C' = counter sample
+    unsigned thread;
+    Clock::time_point start;
+    Clock::duration duration;
+    uint64_t value;
+};
+
+class Profiler {
+public:
+    Profiler() : origin(Clock::now()) {}
+
+    void recordSpan(const char* name, unsigned thread, Clock::time_point start, Clock::time_point end){
+        const std::scoped_lock lock(mutex);
+        events.push_back({name, 'X', thread, start, end - start, 0});
+        phaseTotals[name] += end - start;
+    }
+
+    void addToCounter(const char* name, uint64_t amount){
+        const std::scoped_lock lock(mutex);
+        counters[name] += amount;
+    }
+
+    // Route every task run by the pool through the profiler, so the trace shows one span per task on each worker row.
+    void attachPool(BS::thread_pool &pool){
+        pool.set_task_observer([this] (const BS::task_record &task) {
+            const std::scoped_lock lock(mutex);
+            events.push_back({"task", 'X', static_cast<unsigned>(task.thread_index) + 1, task.start, task.end - task.start, 0});
+            events.push_back({"queue depth", 'C', static_cast<unsigned>(task.thread_index) + 1, task.start, Clock::duration::zero(), task.queue_depth});
+            maxQueueDepth = std::max(maxQueueDepth, task.queue_depth);
+        });
+        attachedPool = &pool;
+    }
+
+    void detachPool(){
+        if(attachedPool != nullptr){
+            attachedPool->set_task_observer(nullptr);
+            attachedPool = nullptr;
+        }
+    }
+
+    void printSummary(std::ostream &out){
+        const std::scoped_lock lock(mutex);
+        out << std::fixed << std::setprecision(1) << "== Sieve profile ==" << std::endl;
+        for(auto &[name, total] : phaseTotals){
+            out << "  phase " << name << ": " << toMicros(total) << " us" << std::endl;
+        }
+        for(auto &[name, total] : counters){
+            out << "  counter " << name << ": " << total << std::endl;
+        }
+        out << "  max queue depth: " << maxQueueDepth << std::endl;
+        if(attachedPool != nullptr){
+            std::vector<BS::worker_stats> stats = attachedPool->get_worker_stats();
+            for(size_t i = 0; i < stats.size(); i++){
+                out << "  worker " << i << ": " << stats[i].tasks_executed << " tasks, busy "
+                    << toMicros(stats[i].busy_time) << " us, idle " << toMicros(stats[i].idle_time) << " us" << std::endl;
+            }
+        }
+    }
+
+    // Chrome trace event format: https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+    void writeChromeTrace(const std::string &path){
+        const std::scoped_lock lock(mutex);
+        std::ofstream file(path);
+        file << "{\"traceEvents\":[" << std::endl;
+        bool first = true;
+        for(TraceEvent &event : events){
+            file << (first ? "" : ",\n");
+            first = false;
+            file << "{\"name\":\"" << event.name << "\",\"ph\":\"" << event.phase << "\",\"pid\":1,\"tid\":" << event.thread
+                 << ",\"ts\":" << toMicros(event.start - origin);
+            if(event.phase == 'X'){
+                file << ",\"dur\":" << toMicros(event.duration) << "}";
+            } else {
+                file << ",\"args\":{\"value\":" << event.value << "}}";
+            }
+        }
+        for(auto &[name, total] : counters){
+            file << (first ? "" : ",\n");
+            first = false;
+            file << "{\"name\":\"" << name << "\",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":0,\"args\":{\"total\":" << total << "}}";
+        }
+        file << "\n],\"displayTimeUnit\":\"ms\"}" << std::endl;
+    }
+
+private:
+    static double toMicros(Clock::duration duration){
+        return std::chrono::duration<double, std::micro>(duration).count();
+    }
+
+    std::mutex mutex;
+    Clock::time_point origin;
+    std::vector<TraceEvent> events;
+    std::map<std::string, Clock::duration> phaseTotals;
+    std::map<std::string, uint64_t> counters;
+    size_t maxQueueDepth = 0;
+    BS::thread_pool* attachedPool = nullptr;
+};
+
+inline Profiler& profiler(){
+    static Profiler instance;
+    return instance;
+}
+
+// Times the enclosing scope and records it as a span on the current thread's row.
+class ScopedPhase {
+public:
+    explicit ScopedPhase(const char* name) : name(name), start(Clock::now()) {}
+    ~ScopedPhase(){ profiler().recordSpan(name, currentTraceThread(), start, Clock::now()); }
+    ScopedPhase(const ScopedPhase&) = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+private:
+    const char* name;
+    Clock::time_point start;
+};
+
+} // namespace sieveprof
+
+#define SIEVE_PROFILE_CONCAT_INNER(a, b) a##b
+#define SIEVE_PROFILE_CONCAT(a, b) SIEVE_PROFILE_CONCAT_INNER(a, b)
+#define SIEVE_PROFILE_PHASE(name) const sieveprof::ScopedPhase SIEVE_PROFILE_CONCAT(sieveProfilePhase, __LINE__)(name)
+#define SIEVE_PROFILE_COUNT(name, amount) sieveprof::profiler().addToCounter(name, amount)
+#define SIEVE_PROFILE_LOCAL_COUNTER(variable) uint64_t variable = 0
+#define SIEVE_PROFILE_INCREMENT(variable) (++(variable))
+#define SIEVE_PROFILE_ATTACH_POOL(pool) sieveprof::profiler().attachPool(pool)
+#define SIEVE_PROFILE_DETACH_POOL() sieveprof::profiler().detachPool()
+#define SIEVE_PROFILE_REPORT(out, tracePath) do { sieveprof::profiler().printSummary(out); sieveprof::profiler().writeChromeTrace(tracePath); } while (false)
+
+#else
+
+#define SIEVE_PROFILE_PHASE(name) do {} while (false)
+#define SIEVE_PROFILE_COUNT(name, amount) do {} while (false)
+#define SIEVE_PROFILE_LOCAL_COUNTER(variable) do {} while (false)
+#define SIEVE_PROFILE_INCREMENT(variable) do {} while (false)
+#define SIEVE_PROFILE_ATTACH_POOL(pool) do {} while (false)
+#define SIEVE_PROFILE_DETACH_POOL() do {} while (false)
+#define SIEVE_PROFILE_REPORT(out, tracePath) do {} while (false)
+
+#endif
+
+#endif
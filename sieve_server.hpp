@@ -0,0 +1,507 @@
+#ifndef SIEVE_SERVER_HPP
+#define SIEVE_SERVER_HPP
+
+/**
+ * A long-lived sieve server on a Unix domain socket, so that high-rate queries do not each pay for process start,
+ * thread creation, base primes and page faults.
+ *
+ * The server keeps the thread pool, a SharedBitmap of [0, limit] with the count and sum of the primes before every
+ * block of INDEX_BLOCK_WORDS words (the index), the small prime tables of the primality test and tail queries, and a
+ * log of recent request latencies. A count over [a, b] inside the index is two prefix lookups plus at most one block
+ * of popcounts each; past the index it falls back to the segmented engine on the pool. The base primes of those
+ * fallbacks are kept warm in one BasePrimeTable, which is replaced by a larger one, at least twice its limit, when a
+ * count reaches past the square of its limit; requests still using the old table keep it until they are done.
+ *
+ * The protocol is binary, in host byte order, since both ends are on the same machine. A client sends a batch as a
+ * uint32 count followed by that many 24-byte Requests, and gets back a uint32 count followed by as many 32-byte
+ * Responses in the same order. A connection can send any number of batches. The meaning of a response's values:
+ *   count [a, b]      values[0] = number of primes, values[1], values[2] = low and high 64 bits of their sum; with a
+ *                     deadline that passes first, status timeout and the count, the low 64 bits of the sum and the
+ *                     end c of the prefix [a, c] they cover; status bad request if b > MAX_COUNT_HIGH, or if there
+ *                     is no deadline and more than MAX_SIEVED_WIDTH numbers of [a, b] lie past the index
+ *   is-prime a        values[0] = 1 if a is prime
+ *   next-prime a      values[0] = smallest prime > a (0 if none below 2^64)
+ *   prev-prime a      values[0] = largest prime < a (0 if none)
+ *   stats             values[0] = requests served, values[1], values[2] = p50 and p99 latency in ns
+ *   shutdown          stops accepting connections; the server exits once every open connection is done
+ * Each connection is served by its own thread. The server logs the time it spends on each request; the load
+ * generator (sieve_load.hpp) measures the round trips of whole batches from the client's side.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BS_thread_pool.hpp"
+#include "prime_count.hpp"
+#include "prime_tail.hpp"
+#include "primality.hpp"
+#include "range_planner.hpp"
+#include "segmented_sieve.hpp"
+#include "shared_bitmap.hpp"
+
+#ifdef __unix__
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace sieveserver {
+
+const uint32_t MAX_BATCH = 1 << 16;       // requests per batch; larger counts close the connection
+const size_t INDEX_BLOCK_WORDS = 64;      // prefix totals every 64 words, i.e. every 8192 numbers
+const size_t LATENCY_SAMPLES = 1 << 20;   // latencies kept per operation, the most recent ones
+const uint64_t MAX_COUNT_HIGH = 1ULL << 56;     // keeps a count's base primes, up to sqrt(b), below 15 million
+const uint64_t MAX_SIEVED_WIDTH = 1ULL << 32;   // numbers a count without a deadline may sieve past the index
+
+enum Op : uint32_t { OP_COUNT = 1, OP_IS_PRIME = 2, OP_NEXT_PRIME = 3, OP_PREV_PRIME = 4, OP_STATS = 5, OP_SHUTDOWN = 6 };
+const uint32_t OP_END = 7;
+const char* const OP_NAMES[OP_END] = {"", "count", "is-prime", "next-prime", "prev-prime", "stats", "shutdown"};
+
+enum Status : uint32_t { STATUS_OK = 0, STATUS_BAD_REQUEST = 1, STATUS_TIMEOUT = 2 };
+
+struct Request {
+    uint32_t op;
+    uint32_t deadlineMs;  // count: give up sieving past the index after this long (0: no deadline)
+    uint64_t a;
+    uint64_t b;
+};
+
+struct Response {
+    uint32_t status;
+    uint32_t reserved;
+    uint64_t values[3];
+};
+
+static_assert(sizeof(Request) == 24 && sizeof(Response) == 32, "the wire format has fixed record sizes");
+
+// The q-quantile (0 <= q <= 1) of values, 0 if there are none.
+inline uint64_t percentile(std::vector<uint64_t> values, double q){
+    if(values.empty()){ return 0; }
+    size_t rank = std::min(values.size() - 1, (size_t)(q * (double)values.size()));
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+}
+
+// Socket helpers; they fail with a message on platforms without Unix domain sockets.
+inline int listenOn(const std::string &path, std::string &error){
+#ifdef __unix__
+    sockaddr_un address{};
+    if(path.size() >= sizeof(address.sun_path)){
+        error = "socket path is too long: " + path;
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if(fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, 64) != 0){
+        error = "cannot listen on " + path + ": " + std::strerror(errno);
+        if(fd >= 0){ close(fd); }
+        return -1;
+    }
+    return fd;
+#else
+    error = "the server needs Unix domain sockets";
+    return -1;
+#endif
+}
+
+inline int connectTo(const std::string &path, std::string &error){
+#ifdef __unix__
+    sockaddr_un address{};
+    if(path.size() >= sizeof(address.sun_path)){
+        error = "socket path is too long: " + path;
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0){
+        error = "cannot connect to " + path + ": " + std::strerror(errno);
+        if(fd >= 0){ close(fd); }
+        return -1;
+    }
+    return fd;
+#else
+    error = "the client needs Unix domain sockets";
+    return -1;
+#endif
+}
+
+inline bool readFully(int fd, void* data, size_t size){
+#ifdef __unix__
+    char* bytes = static_cast<char*>(data);
+    while(size > 0){
+        ssize_t got = read(fd, bytes, size);
+        if(got < 0 && errno == EINTR){ continue; }
+        if(got <= 0){ return false; }
+        bytes += got;
+        size -= (size_t)got;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline bool writeFully(int fd, const void* data, size_t size){
+#ifdef __unix__
+    const char* bytes = static_cast<const char*>(data);
+    while(size > 0){
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if(sent < 0 && errno == EINTR){ continue; }
+        if(sent <= 0){ return false; }
+        bytes += sent;
+        size -= (size_t)sent;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline void closeSocket(int fd){
+#ifdef __unix__
+    if(fd >= 0){ close(fd); }
+#endif
+}
+
+// The bitmap of [0, limit] plus the count and sum of the primes below every block, for prefix totals in O(block).
+class PrimeIndex {
+public:
+    void build(BS::thread_pool &pool, uint64_t limit, const segsieve::SieveConfig &config){
+        bitmap.build(pool, limit, config);
+        size_t words = (size_t)(((limit + 1) / 2 + 63) / 64);
+        size_t blocks = words / INDEX_BLOCK_WORDS + 1;
+        counts.assign(blocks + 1, 0);
+        sums.assign(blocks + 1, 0);
+        pool.submit_blocks<size_t>(0, blocks, [&] (size_t first, size_t last) {
+            for(size_t block = first; block < last; block++){
+                for(size_t w = block * INDEX_BLOCK_WORDS; w < std::min(words, (block + 1) * INDEX_BLOCK_WORDS); w++){
+                    for(uint64_t word = bitmap.data()[w]; word != 0; word &= word - 1){
+                        counts[block + 1]++;
+                        sums[block + 1] += 128 * (uint64_t)w + 2 * (uint64_t)__builtin_ctzll(word) + 1;
+                    }
+                }
+            }
+        }).wait();
+        for(size_t block = 1; block <= blocks; block++){
+            counts[block] += counts[block - 1];
+            sums[block] += sums[block - 1];
+        }
+        built = true;
+    }
+
+    bool empty() const { return !built; }
+    uint64_t limit() const { return bitmap.limit(); }
+    bool isPrime(uint64_t n) const { return bitmap.isPrime(n); }
+
+    // Count and sum of the primes up to and including n, for n <= limit().
+    primecount::Totals upTo(uint64_t n) const {
+        if(n < 2){ return {}; }
+        primecount::Totals totals{1, 2};
+        if(n < 3){ return totals; }
+        uint64_t lastBit = (n - 1) / 2;  // the largest odd number <= n
+        size_t lastWord = (size_t)(lastBit / 64), block = lastWord / INDEX_BLOCK_WORDS;
+        totals.count += counts[block];
+        totals.sum += sums[block];
+        for(size_t w = block * INDEX_BLOCK_WORDS; w <= lastWord; w++){
+            uint64_t word = bitmap.data()[w];
+            if(w == lastWord && lastBit % 64 != 63){ word &= (2ULL << (lastBit % 64)) - 1; }
+            totals.count += __builtin_popcountll(word);
+            for(; word != 0; word &= word - 1){ totals.sum += 128 * (uint64_t)w + 2 * (uint64_t)__builtin_ctzll(word) + 1; }
+        }
+        return totals;
+    }
+
+private:
+    sharedbitmap::SharedBitmap bitmap;
+    std::vector<uint64_t> counts;            // counts[b] = primes in the blocks before block b, excluding 2
+    std::vector<segsieve::PrimeSum> sums;
+    bool built = false;
+};
+
+// Recent latencies per operation, in nanoseconds.
+class LatencyLog {
+public:
+    void record(uint32_t op, uint64_t nanoseconds){
+        const std::scoped_lock lock(mutex);
+        std::vector<uint64_t> &samples = perOp[op];
+        if(samples.size() < LATENCY_SAMPLES){ samples.push_back(nanoseconds); }
+        else { samples[next[op] % LATENCY_SAMPLES] = nanoseconds; }
+        next[op]++;
+        served++;
+    }
+
+    uint64_t requests() const {
+        const std::scoped_lock lock(mutex);
+        return served;
+    }
+
+    // The samples of one operation, or of every operation for op 0.
+    std::vector<uint64_t> samples(uint32_t op) const {
+        const std::scoped_lock lock(mutex);
+        if(op != 0){ return perOp[op]; }
+        std::vector<uint64_t> all;
+        for(const std::vector<uint64_t> &samples : perOp){ all.insert(all.end(), samples.begin(), samples.end()); }
+        return all;
+    }
+
+    void print(std::ostream &out) const {
+        for(uint32_t op = 1; op < OP_END; op++){
+            std::vector<uint64_t> values = samples(op);
+            if(values.empty()){ continue; }
+            uint64_t requests;
+            {
+                const std::scoped_lock lock(mutex);
+                requests = next[op];
+            }
+            out << OP_NAMES[op] << ": " << requests << " requests, p50 " << percentile(values, 0.5) / 1000.0 << " us, p99 "
+                << percentile(values, 0.99) / 1000.0 << " us" << std::endl;
+        }
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::vector<uint64_t> perOp[OP_END];
+    uint64_t next[OP_END] = {};
+    uint64_t served = 0;
+};
+
+class Server {
+public:
+    Server(BS::thread_pool &pool, const segsieve::SieveConfig &config) : pool(pool), config(config) {}
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // Sieves the index and warms the small prime tables. Call it before run(); limit 0 leaves the index out.
+    void warmUp(uint64_t indexLimit){
+        if(indexLimit > 0){ index.build(pool, indexLimit, config); }
+        primality::isPrime(primality::TABLE_LIMIT + 1);
+        primetail::smallPrimes();
+    }
+
+    const PrimeIndex& primeIndex() const { return index; }
+    const LatencyLog& latencies() const { return log; }
+
+    Response handle(const Request &request){
+        Response response{STATUS_OK, 0, {0, 0, 0}};
+        switch(request.op){
+        case OP_COUNT: {
+            if(request.a > request.b){
+                response.status = STATUS_BAD_REQUEST;
+                break;
+            }
+            primecount::Totals totals;
+            uint64_t from = 0;
+            bool pastIndex = countIndexed(request.a, request.b, totals, from);
+            if(request.b > MAX_COUNT_HIGH || (pastIndex && refused(request, from))){
+                response.status = STATUS_BAD_REQUEST;
+                break;
+            }
+            if(pastIndex){
+                segsieve::PrimeSummary rest;
+                std::shared_ptr<segsieve::BasePrimeTable> basePrimes = basePrimesUpTo(request.b);
+                if(request.deadlineMs > 0){
+                    segsieve::PartialSummary partial = segsieve::summarizeUntil(pool, *basePrimes, from, request.b, config,
+                                                                                BS::cancel_token(std::chrono::milliseconds(request.deadlineMs)));
+                    if(!partial.complete){
+                        response = {STATUS_TIMEOUT, 0, {totals.count + partial.summary.count, (uint64_t)(totals.sum + partial.summary.sum), partial.reached}};
+                        break;
+                    }
+                    rest = partial.summary;
+                } else {
+                    rest = segsieve::summarizeRange(pool, *basePrimes, from, request.b, config);
+                }
+                totals.count += rest.count;
+                totals.sum += rest.sum;
+            }
+            setTotals(response, totals);
+            break;
+        }
+        case OP_IS_PRIME:
+            response.values[0] = !index.empty() && request.a <= index.limit() ? index.isPrime(request.a) : primality::isPrime(request.a);
+            break;
+        case OP_NEXT_PRIME:
+            response.values[0] = primetail::nextPrime(request.a);
+            break;
+        case OP_PREV_PRIME:
+            response.values[0] = primetail::prevPrime(request.a);
+            break;
+        case OP_STATS: {
+            std::vector<uint64_t> all = log.samples(0);
+            response.values[0] = log.requests();
+            response.values[1] = percentile(all, 0.5);
+            response.values[2] = percentile(all, 0.99);
+            break;
+        }
+        case OP_SHUTDOWN:
+            stop();
+            break;
+        default:
+            response.status = STATUS_BAD_REQUEST;
+        }
+        return response;
+    }
+
+    // Accepts connections on path until a shutdown request, then waits for the open connections to finish.
+    bool run(const std::string &path, std::ostream &out){
+        std::string error;
+        listener = listenOn(path, error);
+        if(listener < 0){
+            out << error << std::endl;
+            return false;
+        }
+        out << "listening on " << path << std::endl;
+#ifdef __unix__
+        while(!stopping){
+            int fd = accept(listener, nullptr, nullptr);
+            if(fd < 0){
+                if(stopping){ break; }
+                if(errno == EINTR || errno == ECONNABORTED){ continue; }
+                out << "accept failed: " << std::strerror(errno) << std::endl;
+                break;
+            }
+            {
+                const std::scoped_lock lock(mutex);
+                connections.insert(fd);
+            }
+            std::thread([this, fd] { serve(fd); }).detach();
+        }
+        std::unique_lock lock(mutex);
+        finished.wait(lock, [this] { return connections.empty(); });
+        closeSocket(listener);
+        unlink(path.c_str());
+#endif
+        return true;
+    }
+
+    // Answers a batch in order and logs each request's latency. The counts without a deadline that reach past the
+    // index are answered together at the end, with one planned sieve of their tails, and each is logged as having
+    // waited for all of it.
+    void handleBatch(const Request* requests, Response* responses, uint32_t count){
+        std::vector<rangeplanner::RangeQuery> tails;
+        std::vector<uint32_t> owners;
+        std::vector<primecount::Totals> indexedParts;
+        for(uint32_t i = 0; i < count; i++){
+            auto begin = std::chrono::steady_clock::now();
+            uint64_t from = 0;
+            primecount::Totals totals;
+            if(requests[i].op == OP_COUNT && requests[i].deadlineMs == 0 && requests[i].a <= requests[i].b && requests[i].b <= MAX_COUNT_HIGH
+               && countIndexed(requests[i].a, requests[i].b, totals, from) && !refused(requests[i], from)){
+                responses[i] = {STATUS_OK, 0, {0, 0, 0}};
+                indexedParts.push_back(totals);
+                tails.push_back({from, requests[i].b});
+                owners.push_back(i);
+                continue;
+            }
+            responses[i] = handle(requests[i]);
+            uint32_t op = requests[i].op < OP_END ? requests[i].op : 0;
+            if(op != 0){ log.record(op, elapsedSince(begin)); }
+        }
+        if(tails.empty()){ return; }
+        auto begin = std::chrono::steady_clock::now();
+        rangeplanner::QueryPlan plan = rangeplanner::planQueries(tails, config);
+        std::shared_ptr<segsieve::BasePrimeTable> basePrimes = basePrimesUpTo(plan.merged.back().high);
+        std::vector<segsieve::PrimeSummary> rests = rangeplanner::answerQueries(pool, *basePrimes, tails, config, plan);
+        uint64_t elapsed = elapsedSince(begin);
+        for(size_t k = 0; k < tails.size(); k++){
+            setTotals(responses[owners[k]], {indexedParts[k].count + rests[k].count, indexedParts[k].sum + rests[k].sum});
+            log.record(OP_COUNT, elapsed);
+        }
+    }
+
+private:
+    static uint64_t elapsedSince(std::chrono::steady_clock::time_point begin){
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    static void setTotals(Response &response, const primecount::Totals &totals){
+        response.values[0] = totals.count;
+        response.values[1] = (uint64_t)totals.sum;
+        response.values[2] = (uint64_t)(totals.sum >> 64);
+    }
+
+    // Counts the part of [a, b] the index covers into totals. Returns true with the first number past it in from if
+    // the rest of the range still has to be sieved.
+    bool countIndexed(uint64_t a, uint64_t b, primecount::Totals &totals, uint64_t &from){
+        uint64_t indexed = index.empty() ? 0 : index.limit();
+        if(!index.empty() && a <= indexed){
+            primecount::Totals high = index.upTo(std::min(b, indexed)), low = a == 0 ? primecount::Totals{} : index.upTo(a - 1);
+            totals = {high.count - low.count, high.sum - low.sum};
+        }
+        from = index.empty() ? a : std::max(a, indexed + 1);
+        return b > indexed || index.empty();
+    }
+
+    // Whether a count that has to sieve [from, b] past the index is too wide to be answered without a deadline. A
+    // deadline bounds the time of any count, so those are always served.
+    static bool refused(const Request &request, uint64_t from){
+        return request.deadlineMs == 0 && request.b - from >= MAX_SIEVED_WIDTH;
+    }
+
+    // The warm base prime table, first replaced by one that covers sqrt(high) if it does not.
+    std::shared_ptr<segsieve::BasePrimeTable> basePrimesUpTo(uint64_t high){
+        uint64_t root = segsieve::integerSqrt(high);
+        const std::scoped_lock lock(tableMutex);
+        if(basePrimes == nullptr || basePrimes->limit() < root){
+            uint64_t limit = basePrimes == nullptr ? root : std::max(root, 2 * basePrimes->limit());
+            basePrimes = std::make_shared<segsieve::BasePrimeTable>();
+            basePrimes->start(pool, std::min(limit, segsieve::integerSqrt(MAX_COUNT_HIGH)), config);
+        }
+        return basePrimes;
+    }
+
+    void serve(int fd){
+        std::vector<Request> requests;
+        std::vector<Response> responses;
+        for(uint32_t count; readFully(fd, &count, sizeof(count)) && count <= MAX_BATCH;){
+            requests.resize(count);
+            responses.resize(count);
+            if(!readFully(fd, requests.data(), count * sizeof(Request))){ break; }
+            handleBatch(requests.data(), responses.data(), count);
+            if(!writeFully(fd, &count, sizeof(count)) || !writeFully(fd, responses.data(), count * sizeof(Response)) || stopping){ break; }
+        }
+        closeSocket(fd);
+        const std::scoped_lock lock(mutex);
+        connections.erase(fd);
+        finished.notify_all();
+    }
+
+    // Wakes the accept loop and every connection waiting for its next batch.
+    void stop(){
+        stopping = true;
+#ifdef __unix__
+        const std::scoped_lock lock(mutex);
+        if(listener >= 0){ shutdown(listener, SHUT_RDWR); }
+        for(int fd : connections){ shutdown(fd, SHUT_RD); }
+#endif
+    }
+
+    BS::thread_pool &pool;
+    segsieve::SieveConfig config;
+    PrimeIndex index;
+    LatencyLog log;
+    std::mutex tableMutex;
+    std::shared_ptr<segsieve::BasePrimeTable> basePrimes;
+    std::atomic<bool> stopping{false};
+    int listener = -1;
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::set<int> connections;
+};
+
+} // namespace sieveserver
+
+#endif
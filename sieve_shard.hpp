@@ -0,0 +1,276 @@
+#ifndef SIEVE_SHARD_HPP
+#define SIEVE_SHARD_HPP
+
+/**
+ * Splitting one sieve across several processes or machines, and merging their results.
+ *
+ * The range [0, limit] is cut into n shards near segment boundaries, each rounded down to a multiple of 128 numbers,
+ * so every shard starts on a whole bitmap word and the shards' bitmaps can simply be concatenated. A process started with --shard i/n sieves only shard i with the
+ * segmented engine and writes a small partial result file: the shard's range, count, sum, its smallest and largest
+ * primes (the boundary primes, which is all a merge needs to stitch neighbours together), and optionally the path of
+ * a raw bitmap file with the shard's odd-only bits. --merge reads the partial files back, checks that they are one
+ * complete set of shards of the same run, and combines them.
+ *
+ * The partial file is key=value text like the tuning profile; the bitmap is the packed words in host byte order,
+ * bit i of the shard's bitmap standing for low + 2i + 1.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "BS_thread_pool.hpp"
+#include "segmented_sieve.hpp"
+
+namespace sieveshard {
+
+const size_t BATCH_SEGMENTS = 1024;  // segments sieved per reduceRange() call, which bounds the bitmap kept in memory
+
+struct ShardRange {
+    uint64_t low = 0;   // a multiple of 128, i.e. of one bitmap word
+    uint64_t high = 0;  // inclusive
+};
+
+// Shard shard of shards over [0, limit]: a contiguous run of about segmentCount / shards segments, with both ends
+// rounded down to whole bitmap words (a span is at least 128 numbers, so no shard comes out empty). Needs shards
+// <= segmentCount.
+inline ShardRange shardRange(uint64_t limit, unsigned shard, unsigned shards, const segsieve::SieveConfig &config){
+    uint64_t span = segsieve::segmentSpan(config);
+    uint64_t segments = segsieve::segmentCount(0, limit, config);
+    uint64_t first = segments * shard / shards, last = segments * (shard + 1) / shards;
+    return {first * span / 128 * 128, last == segments ? limit : std::min(limit, last * span / 128 * 128 - 1)};
+}
+
+// ORs the bits of segment into words, the bitmap of the odd numbers from low (a multiple of 128) on. Segments whose
+// span is not a multiple of 128 numbers start inside a word and share it with their neighbour, so such words are
+// merged atomically; the words a segment covers completely are stored plainly.
+inline void copySegment(const segsieve::SegmentView &segment, uint64_t* words, uint64_t low){
+    if(segment.bitCount == 0){ return; }
+    size_t firstBit = (size_t)((segment.low - low) / 2), lastBit = firstBit + segment.bitCount - 1;
+    size_t firstWord = firstBit / 64, lastWord = lastBit / 64;
+    unsigned shift = firstBit % 64;
+    for(size_t word = firstWord; word <= lastWord; word++){
+        size_t j = word - firstWord;  // segment word that supplies the high bits of this word
+        uint64_t value = j < segment.wordCount() ? segment.words[j] << shift : 0;
+        if(shift != 0 && j > 0){ value |= segment.words[j - 1] >> (64 - shift); }
+        uint64_t mask = ~0ULL;  // which bits of this word belong to the segment
+        if(word == firstWord){ mask &= ~0ULL << shift; }
+        if(word == lastWord && lastBit % 64 != 63){ mask &= (1ULL << (lastBit % 64 + 1)) - 1; }
+        if(mask == ~0ULL){ words[word] = value; }
+        else { __atomic_fetch_or(&words[word], value & mask, __ATOMIC_RELAXED); }
+    }
+}
+
+struct PartialResult {
+    uint64_t limit = 0;
+    unsigned shard = 0;
+    unsigned shards = 1;
+    uint64_t low = 0;
+    uint64_t high = 0;
+    uint64_t count = 0;
+    segsieve::PrimeSum sum = 0;
+    long long milliseconds = 0;
+    std::vector<uint64_t> smallest;  // up to TOP_PRIMES, increasing
+    std::vector<uint64_t> largest;   // up to TOP_PRIMES, increasing
+    std::string bitmapPath;          // empty when no bitmap was written
+    uint64_t bitmapWords = 0;
+};
+
+// The first k primes of a segment in increasing order.
+inline std::vector<uint64_t> smallestPrimes(const segsieve::SegmentView &segment, size_t k){
+    std::vector<uint64_t> primes;
+    if(segment.includesTwo && k > 0){ primes.push_back(2); }
+    for(size_t i = 0; i < segment.wordCount() && primes.size() < k; i++){
+        for(uint64_t word = segment.words[i]; word != 0 && primes.size() < k; word &= word - 1){
+            primes.push_back(segment.valueAt(i * 64 + __builtin_ctzll(word)));
+        }
+    }
+    return primes;
+}
+
+// Sieves shard shard of shards over [0, limit], in batches of segments. If bitmap is given, the shard's packed
+// bitmap is written to it batch by batch.
+inline PartialResult sieveShard(BS::thread_pool &pool, uint64_t limit, unsigned shard, unsigned shards, const segsieve::SieveConfig &config, std::ostream* bitmap = nullptr){
+    struct ShardPart {
+        segsieve::PrimeSummary summary;
+        std::vector<uint64_t> smallest;
+    };
+
+    ShardRange range = shardRange(limit, shard, shards, config);
+    PartialResult result;
+    result.limit = limit;
+    result.shard = shard;
+    result.shards = shards;
+    result.low = range.low;
+    result.high = range.high;
+
+    // The segments are merged on the pool as they finish. Each segment copies its bits to its own place in the
+    // batch's bitmap; batches start on whole words, since the shard does and a batch spans 1024 segments of 16 numbers
+    // per byte.
+    segsieve::BasePrimeTable basePrimes;
+    basePrimes.start(pool, segsieve::integerSqrt(range.high), config);
+    std::vector<uint64_t> words;
+    uint64_t batchLow = 0;
+    auto extract = [&] (const segsieve::SegmentView &segment) {
+        if(bitmap != nullptr){ copySegment(segment, words.data(), batchLow); }
+        return ShardPart{segsieve::summarizeSegment(segment), smallestPrimes(segment, segsieve::TOP_PRIMES)};
+    };
+    auto merge = [] (ShardPart left, const ShardPart &right) {
+        left.summary = segsieve::mergeSummaries(left.summary, right.summary);
+        for(size_t i = 0; i < right.smallest.size() && left.smallest.size() < segsieve::TOP_PRIMES; i++){ left.smallest.push_back(right.smallest[i]); }
+        return left;
+    };
+    ShardPart total;
+    segsieve::forEachBatch(range.low, range.high, config, BATCH_SEGMENTS, [&] (uint64_t low, uint64_t high) {
+        batchLow = low;
+        if(bitmap != nullptr){ words.assign((size_t)(((high - low + 1) / 2 + 63) / 64), 0); }
+        total = merge(std::move(total), segsieve::reduceRange(pool, basePrimes, low, high, config, extract, merge));
+        if(bitmap != nullptr){
+            bitmap->write(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint64_t));
+            result.bitmapWords += words.size();
+        }
+    });
+    result.count = total.summary.count;
+    result.sum = total.summary.sum;
+    result.smallest = total.smallest;
+    result.largest = total.summary.largest;
+    return result;
+}
+
+inline void writeList(std::ostream &out, const char* key, const std::vector<uint64_t> &values){
+    out << key << "=";
+    for(size_t i = 0; i < values.size(); i++){ out << (i > 0 ? " " : "") << values[i]; }
+    out << std::endl;
+}
+
+inline void writePartial(std::ostream &out, const PartialResult &result){
+    out << "# partial result of ./main.exe --shard " << result.shard << "/" << result.shards << "; combine with --merge" << std::endl;
+    out << "limit=" << result.limit << std::endl;
+    out << "shard=" << result.shard << std::endl;
+    out << "shards=" << result.shards << std::endl;
+    out << "low=" << result.low << std::endl;
+    out << "high=" << result.high << std::endl;
+    out << "count=" << result.count << std::endl;
+    out << "sum=" << segsieve::sumToString(result.sum) << std::endl;
+    out << "milliseconds=" << result.milliseconds << std::endl;
+    writeList(out, "smallest", result.smallest);
+    writeList(out, "largest", result.largest);
+    if(!result.bitmapPath.empty()){
+        out << "bitmap=" << result.bitmapPath << std::endl;
+        out << "bitmap_words=" << result.bitmapWords << std::endl;
+    }
+}
+
+// Reads a file written by writePartial. Returns false if a required key is missing or a value does not parse.
+inline bool readPartial(std::istream &in, PartialResult &result){
+    std::string line;
+    int required = 0;
+    try {
+        while(std::getline(in, line)){
+            if(line.empty() || line[0] == '#'){ continue; }
+            size_t equals = line.find('=');
+            if(equals == std::string::npos){ continue; }
+            std::string key = line.substr(0, equals), value = line.substr(equals + 1);
+            if(key == "smallest" || key == "largest"){
+                std::vector<uint64_t> &list = key == "smallest" ? result.smallest : result.largest;
+                std::istringstream values(value);
+                list.clear();
+                for(uint64_t prime; values >> prime;){ list.push_back(prime); }
+            }
+            else if(key == "bitmap"){ result.bitmapPath = value; }
+            else if(key == "bitmap_words"){ result.bitmapWords = std::stoull(value); }
+            else if(key == "milliseconds"){ result.milliseconds = std::stoll(value); }
+            else if(key == "limit"){ result.limit = std::stoull(value); required++; }
+            else if(key == "shard"){ result.shard = (unsigned)std::stoul(value); required++; }
+            else if(key == "shards"){ result.shards = (unsigned)std::stoul(value); required++; }
+            else if(key == "low"){ result.low = std::stoull(value); required++; }
+            else if(key == "high"){ result.high = std::stoull(value); required++; }
+            else if(key == "count"){ result.count = std::stoull(value); required++; }
+            else if(key == "sum"){
+                if(!segsieve::parseSum(value, result.sum)){ return false; }
+                required++;
+            }
+        }
+    } catch(const std::exception&){
+        return false;
+    }
+    return required == 7;
+}
+
+// Combines one complete set of shards into a result covering [0, limit]. The shard time is the slowest shard's,
+// since the shards are meant to run side by side. Reports what is wrong to errors and returns false otherwise.
+inline bool mergePartials(std::vector<PartialResult> parts, PartialResult &merged, std::ostream &errors){
+    if(parts.empty()){
+        errors << "no partial results to merge" << std::endl;
+        return false;
+    }
+    std::sort(parts.begin(), parts.end(), [] (const PartialResult &a, const PartialResult &b) { return a.shard < b.shard; });
+    const PartialResult &first = parts.front();
+    if(parts.size() != first.shards){
+        errors << "got " << parts.size() << " partial results, but the run was split into " << first.shards << " shards" << std::endl;
+        return false;
+    }
+    for(size_t i = 0; i < parts.size(); i++){
+        const PartialResult &part = parts[i];
+        if(part.limit != first.limit || part.shards != first.shards){
+            errors << "shard " << part.shard << " belongs to a different run (limit " << part.limit << ", " << part.shards << " shards)" << std::endl;
+            return false;
+        }
+        if(part.shard != i){
+            errors << "shard " << i << " is " << (part.shard > i ? "missing" : "given twice") << std::endl;
+            return false;
+        }
+        uint64_t expectedLow = i == 0 ? 0 : parts[i - 1].high + 1;
+        if(part.low != expectedLow || part.high < part.low || (i + 1 == parts.size() && part.high != part.limit)){
+            errors << "shard " << i << " covers [" << part.low << ", " << part.high << "], which does not continue the previous shard" << std::endl;
+            return false;
+        }
+    }
+
+    merged = PartialResult();
+    merged.limit = first.limit;
+    merged.high = first.limit;
+    segsieve::PrimeSummary total;
+    for(const PartialResult &part : parts){
+        total = segsieve::mergeSummaries(total, segsieve::PrimeSummary{part.count, part.sum, part.largest});
+        for(uint64_t prime : part.smallest){
+            if(merged.smallest.size() < segsieve::TOP_PRIMES){ merged.smallest.push_back(prime); }
+        }
+        merged.milliseconds = std::max(merged.milliseconds, part.milliseconds);
+        merged.bitmapWords += part.bitmapWords;
+    }
+    merged.count = total.count;
+    merged.sum = total.sum;
+    merged.largest = total.largest;
+    return true;
+}
+
+// Appends the shards' bitmap files, in shard order, to out; the result is the bitmap of the whole range [0, limit].
+inline bool concatenateBitmaps(const std::vector<PartialResult> &parts, std::ostream &out, std::ostream &errors){
+    std::vector<const PartialResult*> ordered;
+    for(const PartialResult &part : parts){ ordered.push_back(&part); }
+    std::sort(ordered.begin(), ordered.end(), [] (const PartialResult* a, const PartialResult* b) { return a->shard < b->shard; });
+    for(const PartialResult* part : ordered){
+        std::ifstream in(part->bitmapPath, std::ios::binary);
+        if(part->bitmapPath.empty() || !in){
+            errors << "shard " << part->shard << " has no readable bitmap file" << (part->bitmapPath.empty() ? "" : " " + part->bitmapPath) << std::endl;
+            return false;
+        }
+        in.seekg(0, std::ios::end);
+        if((uint64_t)in.tellg() != part->bitmapWords * sizeof(uint64_t)){
+            errors << part->bitmapPath << " should hold " << part->bitmapWords << " words" << std::endl;
+            return false;
+        }
+        in.seekg(0);
+        out << in.rdbuf();
+    }
+    return (bool)out;
+}
+
+} // namespace sieveshard
+
+#endif
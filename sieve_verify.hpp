@@ -0,0 +1,249 @@
+#ifndef SIEVE_VERIFY_HPP
+#define SIEVE_VERIFY_HPP
+
+/**
+ * Correctness suite for the sieve modes, run with ./main.exe --verify (or make verify).
+ *
+ * Each mode is checked three ways:
+ *  1. pi(x) and the sum of primes against published values at powers of ten,
+ *  2. the full prime list against a naive reference sieve at awkward limits (chunk boundaries, limits that are not
+ *     multiples of 30 or of the chunk count, primes, squares of primes and their neighbours),
+ *  3. the prime list against the reference over random ranges (from 0 for modes that only sieve prefixes).
+ * Count-only modes, which cannot list primes, have their count and sum compared at the same limits instead.
+ * Modes that gather statistics about the primes (constellations, gaps, ...) have them compared with the same
+ * statistics of the reference primes, at the awkward limits and over the random ranges.
+ *
+ * The reference is a plain byte-per-number Sieve of Eratosthenes with no wheel, no chunks and no threads, so it
+ * shares none of the code paths under test.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace sieveverify {
+
+struct PrimeTotals {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+};
+
+struct VerifyMode {
+    std::string name;
+    uint64_t minLimit = 2;           // smallest limit the mode accepts
+    uint64_t maxLimit = 0;           // largest limit the suite will ask of the mode
+    bool supportsRanges = false;     // whether listPrimes accepts low > 0 without sieving from 0 anyway
+
+    // All primes p with low <= p <= high, in increasing order. May be empty for count-only modes.
+    std::function<std::vector<uint64_t>(uint64_t low, uint64_t high)> listPrimes;
+
+    // Count and sum of the primes up to and including limit. Optional; derived from listPrimes when empty.
+    std::function<PrimeTotals(uint64_t limit)> countPrimes;
+
+    // Statistics of the primes in [low, high] as a flat list of numbers, and the same statistics computed from the
+    // list of those primes. Optional; a mode with statistics needs neither listPrimes nor countPrimes.
+    std::function<std::vector<uint64_t>(uint64_t low, uint64_t high)> statistics;
+    std::function<std::vector<uint64_t>(const std::vector<uint64_t> &primes, uint64_t low, uint64_t high)> statisticsOf;
+};
+
+// pi(10^k) and the sum of the primes up to 10^k (OEIS A006880 and A046731).
+struct KnownValue {
+    uint64_t limit;
+    uint64_t count;
+    uint64_t sum;
+};
+
+const KnownValue KNOWN_VALUES[] = {
+    {10ULL, 4ULL, 17ULL},
+    {100ULL, 25ULL, 1060ULL},
+    {1000ULL, 168ULL, 76127ULL},
+    {10000ULL, 1229ULL, 5736396ULL},
+    {100000ULL, 9592ULL, 454396537ULL},
+    {1000000ULL, 78498ULL, 37550402023ULL},
+    {10000000ULL, 664579ULL, 3203324994356ULL},
+    {100000000ULL, 5761455ULL, 279209790387276ULL},
+    {1000000000ULL, 50847534ULL, 24739512092254535ULL},
+    {10000000000ULL, 455052511ULL, 2220822432581729238ULL},
+};
+
+// Primes up to and including limit, one byte per number.
+inline std::vector<uint64_t> referencePrimes(uint64_t limit){
+    std::vector<uint64_t> primes;
+    if(limit < 2){ return primes; }
+    std::vector<char> composite(limit + 1, 0);
+    for(uint64_t i = 2; i <= limit; i++){
+        if(composite[i]){ continue; }
+        primes.push_back(i);
+        for(uint64_t j = i * i; j <= limit; j += i){ composite[j] = 1; }
+    }
+    return primes;
+}
+
+// Primes in [low, high], found by crossing off multiples of the reference primes up to sqrt(high).
+inline std::vector<uint64_t> referencePrimes(uint64_t low, uint64_t high){
+    if(low <= 2){ return referencePrimes(high); }
+    std::vector<uint64_t> result;
+    if(high < low){ return result; }
+    uint64_t root = (uint64_t)sqrtl((long double)high);
+    while(root * root > high){ root--; }
+    while((root + 1) * (root + 1) <= high){ root++; }
+    std::vector<char> composite(high - low + 1, 0);
+    for(uint64_t prime : referencePrimes(root)){
+        uint64_t first = std::max(prime * prime, (low + prime - 1) / prime * prime);
+        for(uint64_t j = first; j <= high; j += prime){ composite[j - low] = 1; }
+    }
+    for(uint64_t i = low; i <= high; i++){
+        if(!composite[i - low]){ result.push_back(i); }
+    }
+    return result;
+}
+
+class Suite {
+public:
+    explicit Suite(std::ostream &out) : out(out) {}
+
+    void check(bool passed, const std::string &mode, const std::string &what){
+        checks++;
+        if(!passed){
+            failures++;
+            out << "FAIL [" << mode << "] " << what << std::endl;
+        }
+    }
+
+    bool passed() const { return failures == 0; }
+
+    void summary(){
+        out << checks - failures << "/" << checks << " checks passed" << std::endl;
+    }
+
+private:
+    std::ostream &out;
+    int checks = 0;
+    int failures = 0;
+};
+
+inline PrimeTotals totalsOf(const VerifyMode &mode, uint64_t limit){
+    if(mode.countPrimes){ return mode.countPrimes(limit); }
+    PrimeTotals totals;
+    for(uint64_t prime : mode.listPrimes(0, limit)){
+        totals.count++;
+        totals.sum += prime;
+    }
+    return totals;
+}
+
+// Reports the first position where two prime lists disagree, which is far more useful than "lists differ".
+inline std::string describeMismatch(const std::vector<uint64_t> &actual, const std::vector<uint64_t> &expected, const std::string &items = "primes"){
+    size_t i = 0;
+    while(i < actual.size() && i < expected.size() && actual[i] == expected[i]){ i++; }
+    std::string text = "got " + std::to_string(actual.size()) + " " + items + ", expected " + std::to_string(expected.size());
+    if(i < actual.size() || i < expected.size()){
+        text += "; first difference at position " + std::to_string(i) + ": got "
+              + (i < actual.size() ? std::to_string(actual[i]) : std::string("nothing")) + ", expected "
+              + (i < expected.size() ? std::to_string(expected[i]) : std::string("nothing"));
+    }
+    return text;
+}
+
+// Limits that tend to expose off-by-one errors: around multiples of 30 and of typical chunk counts,
+// at primes and squares of primes (the largest base prime must be used), and their neighbours.
+inline std::vector<uint64_t> awkwardLimits(){
+    std::vector<uint64_t> limits;
+    for(uint64_t base : {30ULL * 37, 30ULL * 1001, 8ULL * 12345, 7ULL * 65537, 13ULL * 99991, 1ULL << 17, 1000000ULL}){
+        for(int delta = -2; delta <= 2; delta++){ limits.push_back(base + delta); }
+    }
+    for(uint64_t prime : {97ULL, 1009ULL, 7919ULL, 104729ULL, 999983ULL}){
+        limits.push_back(prime);
+        limits.push_back(prime - 1);
+        limits.push_back(prime * 2 + 1);
+    }
+    for(uint64_t root : {31ULL, 97ULL, 331ULL, 997ULL}){
+        limits.push_back(root * root - 1);
+        limits.push_back(root * root);
+        limits.push_back(root * root + 1);
+    }
+    return limits;
+}
+
+inline bool runVerification(const std::vector<VerifyMode> &modes, std::ostream &out, uint32_t seed = 20240918){
+    Suite suite(out);
+    std::mt19937_64 random(seed);
+    const uint64_t RANDOM_LIMIT_MAX = 2000000;
+    const int RANDOM_CASES = 6;
+
+    for(const VerifyMode &mode : modes){
+        out << "verifying " << mode.name << std::endl;
+
+        for(const KnownValue &known : KNOWN_VALUES){
+            if(!mode.listPrimes && !mode.countPrimes){ break; }
+            if(known.limit < mode.minLimit || known.limit > mode.maxLimit){ continue; }
+            PrimeTotals totals = totalsOf(mode, known.limit);
+            suite.check(totals.count == known.count && totals.sum == known.sum, mode.name,
+                        "pi(" + std::to_string(known.limit) + ") = " + std::to_string(totals.count) + ", sum "
+                        + std::to_string(totals.sum) + "; expected " + std::to_string(known.count) + ", "
+                        + std::to_string(known.sum));
+        }
+
+        if(mode.statistics){
+            std::vector<std::pair<uint64_t, uint64_t>> ranges;
+            for(uint64_t limit : awkwardLimits()){ ranges.push_back({0, limit}); }
+            for(int i = 0; i < RANDOM_CASES; i++){
+                uint64_t high = std::max<uint64_t>(mode.minLimit, random() % std::min(RANDOM_LIMIT_MAX, mode.maxLimit + 1));
+                ranges.push_back({mode.supportsRanges ? random() % (high + 1) : 0, high});
+            }
+            for(const auto &[low, high] : ranges){
+                if(high < mode.minLimit || high > mode.maxLimit){ continue; }
+                std::vector<uint64_t> actual = mode.statistics(low, high);
+                std::vector<uint64_t> expected = mode.statisticsOf(referencePrimes(low, high), low, high);
+                suite.check(actual == expected, mode.name, "statistics of [" + std::to_string(low) + ", " + std::to_string(high)
+                            + "]: " + describeMismatch(actual, expected, "values"));
+            }
+        }
+        if(!mode.listPrimes && !mode.countPrimes){ continue; }
+
+        if(!mode.listPrimes){
+            std::vector<uint64_t> limits = awkwardLimits();
+            for(int i = 0; i < RANDOM_CASES; i++){ limits.push_back(random() % std::min(RANDOM_LIMIT_MAX, mode.maxLimit + 1)); }
+            for(uint64_t limit : limits){
+                if(limit < mode.minLimit || limit > mode.maxLimit){ continue; }
+                PrimeTotals totals = mode.countPrimes(limit), expected;
+                for(uint64_t prime : referencePrimes(limit)){
+                    expected.count++;
+                    expected.sum += prime;
+                }
+                suite.check(totals.count == expected.count && totals.sum == expected.sum, mode.name,
+                            "pi(" + std::to_string(limit) + ") = " + std::to_string(totals.count) + ", sum " + std::to_string(totals.sum)
+                            + "; expected " + std::to_string(expected.count) + ", " + std::to_string(expected.sum));
+            }
+            continue;
+        }
+
+        for(uint64_t limit : awkwardLimits()){
+            if(limit < mode.minLimit || limit > mode.maxLimit){ continue; }
+            std::vector<uint64_t> actual = mode.listPrimes(0, limit);
+            std::vector<uint64_t> expected = referencePrimes(limit);
+            suite.check(actual == expected, mode.name, "primes up to " + std::to_string(limit) + ": "
+                        + describeMismatch(actual, expected));
+        }
+
+        for(int i = 0; i < RANDOM_CASES; i++){
+            uint64_t high = std::max<uint64_t>(mode.minLimit, random() % std::min(RANDOM_LIMIT_MAX, mode.maxLimit + 1));
+            uint64_t low = mode.supportsRanges ? random() % (high + 1) : 0;
+            std::vector<uint64_t> actual = mode.listPrimes(low, high);
+            std::vector<uint64_t> expected = referencePrimes(low, high);
+            suite.check(actual == expected, mode.name, "primes in [" + std::to_string(low) + ", " + std::to_string(high)
+                        + "]: " + describeMismatch(actual, expected));
+        }
+    }
+    suite.summary();
+    return suite.passed();
+}
+
+} // namespace sieveverify
+
+#endif